@@ -0,0 +1,116 @@
+#ifndef AUDIO_CODEC_H
+#define AUDIO_CODEC_H
+
+#include <gst/gst.h>
+
+#include <string>
+#include <vector>
+
+
+
+
+/**
+@brief what a stream does with the audio track of the camera
+*/
+enum class AudioMode
+{
+    DROP,           // the track is never SETUP, so the camera doesn't send it
+    PASSTHROUGH,    // compressed audio from the depayloader or parser is delivered
+    DECODE          // interleaved S16LE audio is delivered
+};
+
+
+/**
+@brief audio codec of a stream
+*/
+enum class AudioCodec
+{
+    NONE,       // no audio, or a codec no chain is known for
+    AAC,
+    AAC_LATM,
+    PCMU,
+    PCMA,
+    OPUS,
+    G722,
+    L16
+};
+
+
+/**
+@brief elements handling one audio codec after rtspsrc
+*/
+struct AudioCodecElements
+{
+    const char*              name;              // codec name used in logs
+    const char*              depay;             // rtp depayloader
+    const char*              parse;             // parser framing the output, NULL if the depayloader already does
+    std::vector<std::string> decoders;          // in order of preference. Empty if the depayloader outputs raw audio
+};
+
+
+/**
+@param codec codec, NONE is not valid
+@returns the elements of the codec
+*/
+inline const AudioCodecElements& audioCodecElements(const AudioCodec codec)
+{
+    static const AudioCodecElements aac = {"aac", "rtpmp4gdepay", "aacparse", {"avdec_aac", "fdkaacdec", "faad"}};
+    static const AudioCodecElements aac_latm = {"aac-latm", "rtpmp4adepay", "aacparse", {"avdec_aac", "fdkaacdec", "faad"}};
+    static const AudioCodecElements pcmu = {"pcmu", "rtppcmudepay", NULL, {"mulawdec"}};
+    static const AudioCodecElements pcma = {"pcma", "rtppcmadepay", NULL, {"alawdec"}};
+    static const AudioCodecElements opus = {"opus", "rtpopusdepay", NULL, {"opusdec"}};
+    static const AudioCodecElements g722 = {"g722", "rtpg722depay", NULL, {"avdec_g722"}};
+    static const AudioCodecElements l16 = {"l16", "rtpL16depay", NULL, {}};
+    switch(codec)
+    {
+        case AudioCodec::AAC_LATM:
+            return aac_latm;
+        case AudioCodec::PCMU:
+            return pcmu;
+        case AudioCodec::PCMA:
+            return pcma;
+        case AudioCodec::OPUS:
+            return opus;
+        case AudioCodec::G722:
+            return g722;
+        case AudioCodec::L16:
+            return l16;
+        default:
+            return aac;
+    }
+}
+/**
+@param encoding_name encoding-name of an application/x-rtp pad, EG MPEG4-GENERIC
+@returns the codec, NONE if it isn't supported
+*/
+inline AudioCodec audioCodecFromEncodingName(const std::string& encoding_name)
+{
+    const gchar* name = encoding_name.c_str();
+    if(g_ascii_strcasecmp(name, "MPEG4-GENERIC") == 0)
+        return AudioCodec::AAC;
+    if(g_ascii_strcasecmp(name, "MP4A-LATM") == 0)
+        return AudioCodec::AAC_LATM;
+    if(g_ascii_strcasecmp(name, "PCMU") == 0)
+        return AudioCodec::PCMU;
+    if(g_ascii_strcasecmp(name, "PCMA") == 0)
+        return AudioCodec::PCMA;
+    if(g_ascii_strcasecmp(name, "OPUS") == 0)
+        return AudioCodec::OPUS;
+    if(g_ascii_strcasecmp(name, "G722") == 0)
+        return AudioCodec::G722;
+    if(g_ascii_strcasecmp(name, "L16") == 0)
+        return AudioCodec::L16;
+    return AudioCodec::NONE;
+}
+/**
+@returns every audio codec a stream can carry
+*/
+inline const std::vector<AudioCodec>& audioCodecs()
+{
+    static const std::vector<AudioCodec> codecs = {AudioCodec::AAC, AudioCodec::AAC_LATM, AudioCodec::PCMU, AudioCodec::PCMA,
+                                                   AudioCodec::OPUS, AudioCodec::G722, AudioCodec::L16};
+    return codecs;
+}
+
+
+#endif // AUDIO_CODEC_H
@@ -0,0 +1,132 @@
+#ifndef ENCODED_FRAME_H
+#define ENCODED_FRAME_H
+
+#include <gst/gst.h>
+
+#include <functional>
+#include <memory>
+
+
+
+
+/**
+@brief read only view of a compressed access unit pulled from an appsink.
+The sample reference is held for the lifetime of the view and the buffer stays mapped,
+so data() is valid until the last EncodedFramePtr copy is released. No data is copied.
+*/
+class EncodedFrame
+{
+private:
+    GstSample* m_sample;
+    GstBuffer* m_buffer;
+    GstMapInfo m_map;
+    bool       m_mapped;
+
+public:
+    /**
+    @brief maps the buffer held by the sample
+    @param sample sample to map. The view takes ownership of the reference
+    */
+    explicit EncodedFrame(GstSample* sample)
+        : m_sample(sample), m_buffer(NULL), m_map(), m_mapped(false)
+    {
+        if(G_UNLIKELY(m_sample == NULL))
+            return;
+
+        m_buffer = gst_sample_get_buffer(m_sample);
+        if(G_UNLIKELY(m_buffer == NULL))
+            return;
+
+        m_mapped = gst_buffer_map(m_buffer, &m_map, GST_MAP_READ);
+    }
+    /**
+    @brief unmaps the buffer and releases the sample reference
+    */
+    ~EncodedFrame()
+    {
+        if(m_mapped)
+            gst_buffer_unmap(m_buffer, &m_map);
+        if(m_sample != NULL)
+            gst_sample_unref(m_sample);
+    }
+
+    EncodedFrame(EncodedFrame&&) = delete;
+    EncodedFrame(const EncodedFrame&) = delete;
+    /**
+    @returns true if the buffer was mapped. Every other accessor is invalid if this returns false
+    */
+    bool isMapped() const
+    {
+        return m_mapped;
+    }
+    /**
+    @returns pointer to the access unit
+    */
+    const guint8* data() const
+    {
+        return m_map.data;
+    }
+    /**
+    @returns size of the access unit in bytes
+    */
+    gsize size() const
+    {
+        return m_map.size;
+    }
+    /**
+    @returns presentation timestamp, GST_CLOCK_TIME_NONE if unknown
+    */
+    GstClockTime pts() const
+    {
+        return GST_BUFFER_PTS(m_buffer);
+    }
+    /**
+    @returns decoding timestamp, GST_CLOCK_TIME_NONE if unknown
+    */
+    GstClockTime dts() const
+    {
+        return GST_BUFFER_DTS(m_buffer);
+    }
+    /**
+    @returns duration, GST_CLOCK_TIME_NONE if unknown
+    */
+    GstClockTime duration() const
+    {
+        return GST_BUFFER_DURATION(m_buffer);
+    }
+    /**
+    @returns true if the access unit can be decoded on its own
+    */
+    bool isKeyframe() const
+    {
+        return !GST_BUFFER_FLAG_IS_SET(m_buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    }
+    /**
+    @returns the caps of the stream, holding the stream-format and codec data. The view keeps ownership
+    */
+    GstCaps* caps() const
+    {
+        return gst_sample_get_caps(m_sample);
+    }
+    /**
+    @returns the underlying sample. The view keeps ownership
+    */
+    GstSample* sample() const
+    {
+        return m_sample;
+    }
+    /**
+    @returns the underlying buffer. The view keeps ownership
+    */
+    GstBuffer* buffer() const
+    {
+        return m_buffer;
+    }
+};
+
+
+typedef std::shared_ptr<EncodedFrame> EncodedFramePtr;
+typedef std::function<void(const EncodedFramePtr&)> encoded_callback;
+
+
+#endif // ENCODED_FRAME_H
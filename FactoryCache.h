@@ -0,0 +1,93 @@
+#ifndef FACTORY_CACHE_H
+#define FACTORY_CACHE_H
+
+#include <gst/gst.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+
+
+/**
+@brief process wide cache of loaded element factories. The registry is searched and the plugin loaded once per factory name,
+every later lookup is a map find. Misses are cached as well, so probing for optional plugins stays cheap
+*/
+class FactoryCache
+{
+private:
+    std::mutex                                m_mutex;
+    std::map<std::string, GstElementFactory*> m_factories;
+
+    FactoryCache()
+        : m_mutex(), m_factories()
+    {}
+
+public:
+    FactoryCache(FactoryCache&&) = delete;
+    FactoryCache(const FactoryCache&) = delete;
+    /**
+    @returns the process wide cache. The references it holds are never released, the registry keeps the factories alive anyway
+    */
+    static FactoryCache& instance()
+    {
+        static FactoryCache* cache = new FactoryCache();
+        return *cache;
+    }
+    /**
+    @brief looks up a factory and loads its plugin. gstreamer must be initialized
+    @param name plugin feature name
+    @returns the factory, NULL if there is none. The cache keeps ownership
+    */
+    GstElementFactory* find(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_factories.find(name);
+        if(found != m_factories.end())
+            return found->second;
+
+        GstElementFactory* factory = gst_element_factory_find(name.c_str());
+        if(factory != NULL)
+        {
+            // loading resolves the element type now instead of on the first create, which would otherwise serialize every stream on the plugin lock
+            GstPluginFeature* loaded = gst_plugin_feature_load(GST_PLUGIN_FEATURE(factory));
+            gst_object_unref(factory);
+            factory = loaded != NULL ? GST_ELEMENT_FACTORY(loaded) : NULL;
+        }
+        m_factories[name] = factory;
+        return factory;
+    }
+    /**
+    @brief looks up and loads every factory up front
+    @param names plugin feature names
+    @returns number of factories that exist
+    */
+    size_t warm(const std::vector<std::string>& names)
+    {
+        size_t found = 0;
+        for(const std::string& name : names)
+        {
+            if(find(name) != NULL)
+                found++;
+        }
+        return found;
+    }
+    /**
+    @brief creates an element from a cached factory
+    @param factory_name plugin feature name
+    @param element_name element name. can be empty
+    @returns floating reference to the element, NULL if the factory doesn't exist or creation failed
+    */
+    GstElement* create(const std::string& factory_name, const std::string& element_name)
+    {
+        GstElementFactory* factory = find(factory_name);
+        if(factory == NULL)
+            return NULL;
+        return gst_element_factory_create(factory, element_name.empty() ? NULL : element_name.c_str());
+    }
+};
+
+
+#endif // FACTORY_CACHE_H
@@ -0,0 +1,347 @@
+#ifndef FRAME_BATCHER_H
+#define FRAME_BATCHER_H
+
+#include <gst/gst.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Instrumentation.h"
+#include "VideoFrame.h"
+
+
+
+
+/**
+@brief one frame of a batch
+*/
+struct BatchEntry
+{
+    std::string   stream;       // id of the stream the frame came from
+    VideoFramePtr frame;
+    GstClockTime  pts;          // presentation timestamp of the frame in its stream
+    gint64        arrival_us;   // g_get_monotonic_time when the frame reached the batcher
+};
+
+
+typedef std::vector<BatchEntry> FrameBatch;
+typedef std::function<void(FrameBatch& batch)> batch_callback;
+
+
+/**
+@brief counters kept by a FrameBatcher
+*/
+struct BatcherStats
+{
+    guint64 batches;        // batches delivered
+    guint64 frames;         // frames delivered inside batches
+    guint64 replaced;       // frames overwritten by a newer one from the same stream before they were batched
+    guint64 deadlines;      // batches delivered partially filled because max_wait ran out
+    double  fill_ratio;     // frames / (batches * batch_size) over the lifetime of the batcher
+};
+
+
+
+
+/**
+@brief collects the latest frame of many streams into one batch for a single consumer, so a detector runs one batched
+inference instead of one call per stream. Each stream has one slot holding its newest frame. A batch is delivered once
+batch_size slots hold a frame, or max_wait after the first frame of the batch arrived, whichever comes first.
+Batches are delivered in order on a thread owned by the batcher
+*/
+class FrameBatcher
+{
+private:
+    struct Slot
+    {
+        std::string   stream;
+        VideoFramePtr frame;
+        gint64        arrival_us;
+    };
+
+    const std::string       m_name;
+    const batch_callback    m_callback;
+    const size_t            m_batch_size;
+    const gint64            m_max_wait_us;
+
+    std::mutex              m_mutex;
+    std::condition_variable m_condition;
+    std::vector<Slot>       m_slots;
+    size_t                  m_filled;           // slots holding a frame
+    gint64                  m_window_start_us;  // arrival of the oldest frame waiting, 0 when none is
+    bool                    m_stopping;
+    std::thread             m_thread;
+
+    std::atomic<guint64>    m_batches;
+    std::atomic<guint64>    m_frames;
+    std::atomic<guint64>    m_replaced;
+    std::atomic<guint64>    m_deadlines;
+    LatencyHistogram        m_wait;              // from the first frame of a batch arriving to the batch being delivered
+
+    /**
+    @returns the slot of the stream, NULL if the stream isn't an input. m_mutex must be held
+    */
+    Slot* findSlot(const std::string& stream)
+    {
+        for(Slot& slot : m_slots)
+        {
+            if(slot.stream == stream)
+                return &slot;
+        }
+        return NULL;
+    }
+    /**
+    @returns number of frames that complete a batch with the current inputs. m_mutex must be held
+    */
+    size_t batchTarget() const
+    {
+        return std::min(m_batch_size, m_slots.size());
+    }
+    /**
+    @brief stores the newest frame of a stream and wakes the delivery thread when the batch is complete
+    @param stream stream id
+    @param frame frame to store
+    */
+    void push(const std::string& stream, const VideoFramePtr& frame)
+    {
+        const gint64 now = g_get_monotonic_time();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Slot* slot = findSlot(stream);
+        if(G_UNLIKELY(slot == NULL))
+            return;
+
+        if(slot->frame)
+            m_replaced.fetch_add(1, std::memory_order_relaxed);
+        else
+            m_filled++;
+        slot->frame = frame;
+        slot->arrival_us = now;
+
+        if(m_window_start_us == 0)
+        {
+            m_window_start_us = now;
+            m_condition.notify_one();
+        }
+        else if(m_filled >= batchTarget())
+            m_condition.notify_one();
+    }
+    /**
+    @brief moves up to batch_size frames, oldest first, out of the slots. m_mutex must be held
+    @param batch receives the frames
+    */
+    void takeBatch(FrameBatch& batch)
+    {
+        batch.clear();
+        for(Slot& slot : m_slots)
+        {
+            if(slot.frame)
+                batch.push_back({slot.stream, slot.frame, slot.frame->pts(), slot.arrival_us});
+        }
+        std::sort(batch.begin(), batch.end(), [](const BatchEntry& a, const BatchEntry& b){ return a.arrival_us < b.arrival_us; });
+        if(batch.size() > m_batch_size)
+            batch.resize(m_batch_size);
+
+        // frames left behind start the next window at their own arrival
+        gint64 oldest_left = 0;
+        for(Slot& slot : m_slots)
+        {
+            if(!slot.frame)
+                continue;
+            const bool taken = std::any_of(batch.begin(), batch.end(), [&slot](const BatchEntry& entry){ return entry.frame == slot.frame; });
+            if(taken)
+            {
+                slot.frame.reset();
+                m_filled--;
+            }
+            else if(oldest_left == 0 || slot.arrival_us < oldest_left)
+                oldest_left = slot.arrival_us;
+        }
+        m_window_start_us = oldest_left;
+    }
+    /**
+    @brief delivery thread. Waits for a complete batch or the deadline of the current one
+    */
+    void run()
+    {
+        FrameBatch batch;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while(!m_stopping)
+        {
+            if(m_window_start_us == 0 || m_filled == 0)
+            {
+                // removeInput may have taken the last waiting frame with it
+                m_window_start_us = 0;
+                m_condition.wait(lock);
+                continue;
+            }
+            const gint64 deadline = m_window_start_us + m_max_wait_us;
+            const gint64 now = g_get_monotonic_time();
+            const bool complete = m_filled >= batchTarget();
+            if(!complete && now < deadline)
+            {
+                m_condition.wait_for(lock, std::chrono::microseconds(deadline - now));
+                continue;
+            }
+
+            const gint64 window_start = m_window_start_us;
+            takeBatch(batch);
+            lock.unlock();
+
+            m_batches.fetch_add(1, std::memory_order_relaxed);
+            m_frames.fetch_add(batch.size(), std::memory_order_relaxed);
+            if(!complete)
+                m_deadlines.fetch_add(1, std::memory_order_relaxed);
+            m_wait.record(static_cast<guint64>(std::max<gint64>(0, now - window_start)));
+            m_callback(batch);
+            // release the frames before waiting, they pin decoder buffers
+            batch.clear();
+
+            lock.lock();
+        }
+    }
+
+public:
+    /**
+    @brief starts the delivery thread
+    @param name name of the batcher, used as the metrics label
+    @param callback receives every batch on the batcher thread. The entries are sorted by arrival time
+    @param batch_size most frames in one batch
+    @param max_wait_ms longest time the first frame of a batch waits for the batch to fill up
+    */
+    FrameBatcher(const std::string& name, batch_callback callback, const size_t batch_size, const guint max_wait_ms)
+        : m_name(name), m_callback(std::move(callback)), m_batch_size(std::max<size_t>(batch_size, 1)), m_max_wait_us(static_cast<gint64>(max_wait_ms) * 1000),
+          m_mutex(), m_condition(), m_slots(), m_filled(0), m_window_start_us(0), m_stopping(false), m_thread(),
+          m_batches(0), m_frames(0), m_replaced(0), m_deadlines(0), m_wait()
+    {
+        m_thread = std::thread(&FrameBatcher::run, this);
+    }
+    /**
+    @brief stops the delivery thread. Frames still waiting are released without being delivered
+    */
+    ~FrameBatcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+            m_condition.notify_one();
+        }
+        m_thread.join();
+    }
+
+    FrameBatcher(FrameBatcher&&) = delete;
+    FrameBatcher(const FrameBatcher&) = delete;
+    /**
+    @brief adds a stream to the batches
+    @param stream stream id. Adding the same id twice returns a callback feeding the same slot
+    @returns frame callback to set as StreamConfig::on_frame. It holds a pointer to the batcher, which must outlive the stream
+    */
+    frame_callback input(const std::string& stream)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(findSlot(stream) == NULL)
+                m_slots.push_back({stream, VideoFramePtr(), 0});
+        }
+        return [this, stream](const VideoFramePtr& frame){ push(stream, frame); };
+    }
+    /**
+    @brief removes a stream, so batches no longer wait for it. Frames it still delivers are dropped
+    @param stream stream id
+    */
+    void removeInput(const std::string& stream)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for(auto it = m_slots.begin(); it != m_slots.end(); ++it)
+        {
+            if(it->stream != stream)
+                continue;
+            if(it->frame)
+                m_filled--;
+            m_slots.erase(it);
+            m_condition.notify_one();
+            return;
+        }
+    }
+    /**
+    @returns the batcher name
+    */
+    const std::string& name() const
+    {
+        return m_name;
+    }
+    /**
+    @returns most frames in one batch
+    */
+    size_t batchSize() const
+    {
+        return m_batch_size;
+    }
+    /**
+    @returns a snapshot of the batcher counters
+    */
+    BatcherStats stats() const
+    {
+        BatcherStats stats;
+        stats.batches = m_batches.load(std::memory_order_relaxed);
+        stats.frames = m_frames.load(std::memory_order_relaxed);
+        stats.replaced = m_replaced.load(std::memory_order_relaxed);
+        stats.deadlines = m_deadlines.load(std::memory_order_relaxed);
+        stats.fill_ratio = stats.batches != 0 ? static_cast<double>(stats.frames) / (stats.batches * m_batch_size) : 0.0;
+        return stats;
+    }
+    /**
+    @returns time from the first frame of a batch arriving until the batch was delivered
+    */
+    const LatencyHistogram& waitTime() const
+    {
+        return m_wait;
+    }
+    /**
+    @brief writes the batcher metrics in the prometheus text format, without HELP and TYPE lines. See writePrometheusHeaders
+    @param stream output stream
+    @param labels label set of every sample, EG batcher="detector"
+    */
+    void writePrometheus(std::ostream& stream, const std::string& labels) const
+    {
+        const BatcherStats batcher = stats();
+        stream << "rtsp_batcher_batches_total{" << labels << "} " << batcher.batches << '\n'
+               << "rtsp_batcher_frames_total{" << labels << ",outcome=\"batched\"} " << batcher.frames << '\n'
+               << "rtsp_batcher_frames_total{" << labels << ",outcome=\"replaced\"} " << batcher.replaced << '\n'
+               << "rtsp_batcher_deadline_batches_total{" << labels << "} " << batcher.deadlines << '\n'
+               << "rtsp_batcher_fill_ratio{" << labels << "} " << batcher.fill_ratio << '\n';
+        if(m_wait.count() != 0)
+            m_wait.writePrometheus(stream, "rtsp_batcher_wait_seconds", labels);
+    }
+    /**
+    @brief writes the HELP and TYPE lines of every batcher metric
+    @param stream output stream
+    */
+    static void writePrometheusHeaders(std::ostream& stream)
+    {
+        stream << "# HELP rtsp_batcher_batches_total Batches delivered.\n"
+               << "# TYPE rtsp_batcher_batches_total counter\n"
+               << "# HELP rtsp_batcher_frames_total Frames by outcome, batched or overwritten before a batch took them.\n"
+               << "# TYPE rtsp_batcher_frames_total counter\n"
+               << "# HELP rtsp_batcher_deadline_batches_total Batches delivered partially filled because the max wait ran out.\n"
+               << "# TYPE rtsp_batcher_deadline_batches_total counter\n"
+               << "# HELP rtsp_batcher_fill_ratio Delivered frames over batch capacity.\n"
+               << "# TYPE rtsp_batcher_fill_ratio gauge\n"
+               << "# HELP rtsp_batcher_wait_seconds Time from the first frame of a batch arriving until delivery.\n"
+               << "# TYPE rtsp_batcher_wait_seconds histogram\n";
+    }
+};
+
+
+typedef std::shared_ptr<FrameBatcher> FrameBatcherPtr;
+
+
+#endif // FRAME_BATCHER_H
@@ -0,0 +1,241 @@
+#ifndef FRAME_DECIMATOR_H
+#define FRAME_DECIMATOR_H
+
+#include <gst/gst.h>
+
+#include <atomic>
+
+#include "VideoCodec.h"
+
+
+
+
+/**
+@brief counters kept by a FrameDecimator
+*/
+struct DecimationStats
+{
+    guint64 passed;         // access units handed to the decoder and shown
+    guint64 decode_only;    // access units decoded only because later frames reference them
+    guint64 dropped;        // access units dropped before the decoder
+};
+
+
+
+
+/**
+@brief thins a compressed stream out before it reaches the decoder, so frames that are not wanted are never decoded.
+Non-reference frames and, once the keyframes alone reach the target rate, every delta frame are dropped.
+Reference frames that are not due are marked DECODE_ONLY so the decoder decodes them without outputting them
+*/
+class FrameDecimator
+{
+private:
+    std::atomic<guint64> m_interval;        // wanted time between output frames in ns, 0 disables rate decimation
+    std::atomic<bool>    m_keyframes_only;
+
+    // only touched from the decoder streaming thread
+    GstClockTime         m_next_due;
+    GstClockTime         m_last_keyframe;
+    GstClockTime         m_keyframe_interval;
+    bool                 m_dropping_gop;    // the current gop lost a frame, everything up to the next keyframe must go
+    VideoCodec           m_codec;           // set before install, decides how non-reference frames are found
+
+    std::atomic<guint64> m_passed;
+    std::atomic<guint64> m_decode_only;
+    std::atomic<guint64> m_dropped;
+
+    /**
+    @brief checks the nal header of the first slice of a byte-stream access unit. h264 has nal_ref_idc,
+    h265 marks sub-layer non-reference pictures with the even slice nal types below 16. Other codecs are never dropped this way
+    @param buffer access unit
+    @param codec codec of the stream
+    @returns true if no other frame references this one
+    */
+    static bool isNonReference(GstBuffer* buffer, const VideoCodec codec)
+    {
+        if(codec != VideoCodec::H264 && codec != VideoCodec::H265)
+            return false;
+
+        GstMapInfo map;
+        if(!gst_buffer_map(buffer, &map, GST_MAP_READ))
+            return false;
+
+        bool non_reference = false;
+        for(gsize i = 0; i + 3 < map.size; i++)
+        {
+            if(map.data[i] != 0 || map.data[i + 1] != 0 || map.data[i + 2] != 1)
+                continue;
+
+            const guint8 header = map.data[i + 3];
+            if(codec == VideoCodec::H265)
+            {
+                const guint8 type = (header >> 1) & 0x3f;
+                if(type <= 31)
+                {
+                    non_reference = type <= 14 && type % 2 == 0;
+                    break;
+                }
+            }
+            else
+            {
+                const guint8 type = header & 0x1f;
+                if(type >= 1 && type <= 5)
+                {
+                    non_reference = ((header >> 5) & 0x3) == 0;
+                    break;
+                }
+            }
+            i += 2;
+        }
+        gst_buffer_unmap(buffer, &map);
+        return non_reference;
+    }
+    /**
+    @brief checks whether an output frame is due and advances the schedule if it is
+    @param pts presentation timestamp of the frame
+    @param interval wanted time between output frames
+    @returns See above
+    */
+    bool takeIfDue(const GstClockTime pts, const guint64 interval)
+    {
+        if(!GST_CLOCK_TIME_IS_VALID(pts))
+            return true;
+        if(GST_CLOCK_TIME_IS_VALID(m_next_due) && pts < m_next_due)
+            return false;
+
+        // restart the schedule after a gap instead of catching up with a burst
+        m_next_due = (GST_CLOCK_TIME_IS_VALID(m_next_due) && pts < m_next_due + interval) ? m_next_due + interval : pts + interval;
+        return true;
+    }
+    /**
+    @brief decoder sink pad probe
+    */
+    static GstPadProbeReturn onDecoderInput(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+    {
+        FrameDecimator* decimator = static_cast<FrameDecimator*>(user_data);
+        GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+        const guint64 interval = decimator->m_interval.load(std::memory_order_relaxed);
+        const bool keyframes_only = decimator->m_keyframes_only.load(std::memory_order_relaxed);
+        if(interval == 0 && !keyframes_only)
+            return GST_PAD_PROBE_OK;
+
+        const bool keyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+        const GstClockTime pts = GST_BUFFER_PTS(buffer);
+
+        if(keyframe)
+        {
+            if(GST_CLOCK_TIME_IS_VALID(pts) && GST_CLOCK_TIME_IS_VALID(decimator->m_last_keyframe) && pts > decimator->m_last_keyframe)
+                decimator->m_keyframe_interval = pts - decimator->m_last_keyframe;
+            decimator->m_last_keyframe = pts;
+            decimator->m_dropping_gop = false;
+        }
+
+        // when keyframes alone are frequent enough no delta frame is needed, and surplus keyframes can go too
+        const bool intra_only = keyframes_only ||
+                                (GST_CLOCK_TIME_IS_VALID(decimator->m_keyframe_interval) && decimator->m_keyframe_interval <= interval);
+        if(intra_only)
+        {
+            if(keyframe && (interval == 0 || decimator->takeIfDue(pts, interval)))
+                return decimator->pass();
+            // the rest of this gop references what was dropped, so it can't be decoded if the mode changes mid gop
+            decimator->m_dropping_gop = true;
+            return decimator->drop();
+        }
+
+        if(decimator->m_dropping_gop)
+            return decimator->drop();
+        if(decimator->takeIfDue(pts, interval))
+            return decimator->pass();
+        if(!keyframe && isNonReference(buffer, decimator->m_codec))
+            return decimator->drop();
+
+        // still needed as a reference, decode it but don't output it
+        buffer = gst_buffer_make_writable(buffer);
+        GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DECODE_ONLY);
+        GST_PAD_PROBE_INFO_DATA(info) = buffer;
+        decimator->m_decode_only.fetch_add(1, std::memory_order_relaxed);
+        return GST_PAD_PROBE_OK;
+    }
+    /**
+    @returns GST_PAD_PROBE_OK after counting a passed frame
+    */
+    GstPadProbeReturn pass()
+    {
+        m_passed.fetch_add(1, std::memory_order_relaxed);
+        return GST_PAD_PROBE_OK;
+    }
+    /**
+    @returns GST_PAD_PROBE_DROP after counting a dropped frame
+    */
+    GstPadProbeReturn drop()
+    {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return GST_PAD_PROBE_DROP;
+    }
+
+public:
+    /**
+    @param target_fps wanted output rate, 0 keeps every frame
+    @param keyframes_only only decode keyframes
+    */
+    FrameDecimator(const double target_fps = 0.0, const bool keyframes_only = false)
+        : m_interval(0), m_keyframes_only(keyframes_only),
+          m_next_due(GST_CLOCK_TIME_NONE), m_last_keyframe(GST_CLOCK_TIME_NONE), m_keyframe_interval(GST_CLOCK_TIME_NONE), m_dropping_gop(false), m_codec(VideoCodec::H264),
+          m_passed(0), m_decode_only(0), m_dropped(0)
+    {
+        setTargetFps(target_fps);
+    }
+
+    FrameDecimator(FrameDecimator&&) = delete;
+    FrameDecimator(const FrameDecimator&) = delete;
+    /**
+    @brief installs the decimation probe on the decoder sink pad. The decoder must receive one complete frame per buffer,
+    h264 and h265 as byte-stream access units
+    @param decoder decoder element
+    @param codec codec the decoder receives
+    @returns true if the probe was installed
+    */
+    bool install(GstElement* decoder, const VideoCodec codec = VideoCodec::H264)
+    {
+        m_codec = codec;
+        GstPad* pad = decoder != NULL ? gst_element_get_static_pad(decoder, "sink") : NULL;
+        if(pad == NULL)
+            return false;
+
+        const gulong id = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, onDecoderInput, this, NULL);
+        gst_object_unref(pad);
+        return id != 0;
+    }
+    /**
+    @brief changes the output rate. Safe to call while the stream is running
+    @param target_fps wanted output rate, 0 keeps every frame
+    */
+    void setTargetFps(const double target_fps)
+    {
+        m_interval.store(target_fps > 0.0 ? static_cast<guint64>(GST_SECOND / target_fps) : 0, std::memory_order_relaxed);
+    }
+    /**
+    @brief switches keyframes only decoding. Safe to call while the stream is running
+    @param keyframes_only only decode keyframes
+    */
+    void setKeyframesOnly(const bool keyframes_only)
+    {
+        m_keyframes_only.store(keyframes_only, std::memory_order_relaxed);
+    }
+    /**
+    @returns a snapshot of the counters
+    */
+    DecimationStats stats() const
+    {
+        DecimationStats stats;
+        stats.passed = m_passed.load(std::memory_order_relaxed);
+        stats.decode_only = m_decode_only.load(std::memory_order_relaxed);
+        stats.dropped = m_dropped.load(std::memory_order_relaxed);
+        return stats;
+    }
+};
+
+
+#endif // FRAME_DECIMATOR_H
@@ -0,0 +1,286 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+
+
+
+/**
+@brief free list of equally sized memory blocks. Blocks are only returned to the heap when the pool is destroyed,
+so once warmed up allocate/deallocate never touch malloc. The block size is fixed by the first allocation
+*/
+class BlockPool
+{
+private:
+    std::mutex         m_mutex;
+    std::vector<void*> m_free;
+    size_t             m_block_size;
+
+public:
+    /**
+    @param reserve number of free list slots to reserve up front
+    */
+    explicit BlockPool(const size_t reserve = 16)
+        : m_mutex(), m_free(), m_block_size(0)
+    {
+        m_free.reserve(reserve);
+    }
+    /**
+    @brief releases every free block. Outstanding blocks keep the pool alive through PoolAllocator
+    */
+    ~BlockPool()
+    {
+        for(void* block : m_free)
+            ::operator delete(block);
+    }
+
+    BlockPool(BlockPool&&) = delete;
+    BlockPool(const BlockPool&) = delete;
+    /**
+    @brief hands out a block. Sizes other than the pool block size fall back to the heap
+    @param size requested size in bytes
+    @returns the block
+    */
+    void* allocate(const size_t size)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(m_block_size == 0)
+                m_block_size = size;
+            if(size == m_block_size && !m_free.empty())
+            {
+                void* block = m_free.back();
+                m_free.pop_back();
+                return block;
+            }
+        }
+        return ::operator new(size);
+    }
+    /**
+    @brief returns a block to the pool
+    @param block block from allocate
+    @param size size passed to allocate
+    */
+    void deallocate(void* block, const size_t size)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(size == m_block_size)
+            {
+                m_free.push_back(block);
+                return;
+            }
+        }
+        ::operator delete(block);
+    }
+};
+
+
+typedef std::shared_ptr<BlockPool> BlockPoolPtr;
+
+
+
+
+/**
+@brief std allocator drawing from a BlockPool. Used with std::allocate_shared so the object and its control block come from the pool
+*/
+template<typename T>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+
+    BlockPoolPtr pool;
+
+    explicit PoolAllocator(const BlockPoolPtr& block_pool)
+        : pool(block_pool)
+    {}
+
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>& other)
+        : pool(other.pool)
+    {}
+
+    T* allocate(const size_t n)
+    {
+        return static_cast<T*>(pool->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* pointer, const size_t n)
+    {
+        pool->deallocate(pointer, n * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U>& other) const
+    {
+        return pool == other.pool;
+    }
+
+    template<typename U>
+    bool operator!=(const PoolAllocator<U>& other) const
+    {
+        return pool != other.pool;
+    }
+};
+
+
+/**
+@brief constructs a shared object in pooled memory, falling back to std::make_shared without a pool
+@param pool pool to allocate from. can be NULL
+@param args constructor arguments
+@returns See above
+*/
+template<typename T, typename... Args>
+std::shared_ptr<T> makePooled(const BlockPoolPtr& pool, Args&&... args)
+{
+    if(!pool)
+        return std::make_shared<T>(std::forward<Args>(args)...);
+    return std::allocate_shared<T>(PoolAllocator<T>(pool), std::forward<Args>(args)...);
+}
+
+
+
+
+/**
+@brief answers the ALLOCATION query reaching an appsink with a video GstBufferPool owned by us,
+so the element in front of the sink renders into recycled buffers instead of allocating one per frame
+*/
+class SinkBufferPool
+{
+private:
+    guint          m_min_buffers;
+    std::mutex     m_mutex;
+    GstBufferPool* m_pool;
+    GstCaps*       m_caps;
+    gsize          m_buffer_size;   // size of one buffer of the current pool, 0 until caps are negotiated
+
+    /**
+    @brief returns the pool for the caps, replacing the current one if the caps changed. m_mutex must be held
+    @param caps negotiated caps
+    @param info video info parsed from the caps
+    @returns a new reference to the pool, NULL on failure
+    */
+    GstBufferPool* poolFor(GstCaps* caps, const GstVideoInfo& info)
+    {
+        if(m_pool != NULL && gst_caps_is_equal(m_caps, caps))
+            return GST_BUFFER_POOL(gst_object_ref(m_pool));
+
+        GstBufferPool* pool = gst_video_buffer_pool_new();
+        GstStructure* config = gst_buffer_pool_get_config(pool);
+        gst_buffer_pool_config_set_params(config, caps, GST_VIDEO_INFO_SIZE(&info), m_min_buffers, 0);
+        gst_buffer_pool_config_add_option(config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+        if(!gst_buffer_pool_set_config(pool, config))
+        {
+            gst_object_unref(pool);
+            return NULL;
+        }
+
+        if(m_pool != NULL)
+            gst_object_unref(m_pool);
+        if(m_caps != NULL)
+            gst_caps_unref(m_caps);
+        m_pool = pool;
+        m_caps = gst_caps_ref(caps);
+        m_buffer_size = GST_VIDEO_INFO_SIZE(&info);
+        return GST_BUFFER_POOL(gst_object_ref(m_pool));
+    }
+    /**
+    @brief sink pad query probe
+    */
+    static GstPadProbeReturn onQuery(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+    {
+        SinkBufferPool* self = static_cast<SinkBufferPool*>(user_data);
+        GstQuery* query = GST_PAD_PROBE_INFO_QUERY(info);
+        if(GST_QUERY_TYPE(query) != GST_QUERY_ALLOCATION)
+            return GST_PAD_PROBE_OK;
+
+        GstCaps* caps = NULL;
+        gboolean need_pool = FALSE;
+        gst_query_parse_allocation(query, &caps, &need_pool);
+
+        // only plain system memory can be mapped into VideoFrames and cv::Mat headers
+        GstVideoInfo video_info;
+        GstCapsFeatures* features = caps != NULL ? gst_caps_get_features(caps, 0) : NULL;
+        if(caps == NULL || !gst_video_info_from_caps(&video_info, caps) ||
+           (features != NULL && !gst_caps_features_contains(features, GST_CAPS_FEATURE_MEMORY_SYSTEM_MEMORY)))
+            return GST_PAD_PROBE_OK;
+
+        GstBufferPool* pool;
+        {
+            std::lock_guard<std::mutex> lock(self->m_mutex);
+            pool = self->poolFor(caps, video_info);
+        }
+        if(pool == NULL)
+            return GST_PAD_PROBE_OK;
+
+        // no upper bound: a consumer pinning frames makes the pool grow instead of stalling the streaming thread
+        gst_query_add_allocation_pool(query, pool, GST_VIDEO_INFO_SIZE(&video_info), self->m_min_buffers, 0);
+        gst_query_add_allocation_meta(query, GST_VIDEO_META_API_TYPE, NULL);
+        gst_object_unref(pool);
+        return GST_PAD_PROBE_HANDLED;
+    }
+
+public:
+    /**
+    @param min_buffers buffers preallocated by the pool. Size it to every frame that can be alive at once
+    */
+    explicit SinkBufferPool(const guint min_buffers)
+        : m_min_buffers(min_buffers), m_mutex(), m_pool(NULL), m_caps(NULL), m_buffer_size(0)
+    {}
+    /**
+    @brief releases the pool. Buffers still in flight keep it alive
+    */
+    ~SinkBufferPool()
+    {
+        if(m_pool != NULL)
+            gst_object_unref(m_pool);
+        if(m_caps != NULL)
+            gst_caps_unref(m_caps);
+    }
+
+    SinkBufferPool(SinkBufferPool&&) = delete;
+    SinkBufferPool(const SinkBufferPool&) = delete;
+    /**
+    @brief installs the allocation query probe on the appsink sink pad. Must happen before caps are negotiated
+    @param appsink appsink element
+    @returns true if the probe was installed
+    */
+    bool install(GstElement* appsink)
+    {
+        GstPad* pad = appsink != NULL ? gst_element_get_static_pad(appsink, "sink") : NULL;
+        if(pad == NULL)
+            return false;
+
+        const gulong id = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM, onQuery, this, NULL);
+        gst_object_unref(pad);
+        return id != 0;
+    }
+    /**
+    @returns number of buffers preallocated by the pool
+    */
+    guint minBuffers() const
+    {
+        return m_min_buffers;
+    }
+    /**
+    @returns bytes preallocated by the current pool, 0 until caps are negotiated. Buffers the pool grew by are not included
+    */
+    gsize bytes()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_buffer_size * m_min_buffers;
+    }
+};
+
+
+#endif // FRAME_POOL_H
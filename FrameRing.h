@@ -0,0 +1,322 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <gst/gst.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+#include "FramePool.h"
+#include "VideoFrame.h"
+
+
+
+
+/**
+@brief what FrameRing::push does when the ring is full
+*/
+enum class RingPolicy
+{
+    DROP_OLDEST,    // discard the oldest queued sample to make room. Consumers always see the freshest frames
+    DROP_NEWEST,    // discard the sample being pushed. Consumers see frames in order with gaps
+    BLOCK           // wait for a consumer to make room. Stalls the producer, never use it on a streaming thread feeding live video
+};
+
+
+/**
+@brief counters kept by a FrameRing. Each value is read independently, so a snapshot is only approximately consistent
+*/
+struct RingStats
+{
+    guint64 pushed;
+    guint64 popped;
+    guint64 dropped_oldest;
+    guint64 dropped_newest;
+    guint64 blocked;
+};
+
+
+
+
+/**
+@brief fixed capacity, lock free MPMC ring of GstSample references.
+Based on the bounded sequence-numbered queue from Dmitry Vyukov. Any number of producers and consumers may use it concurrently
+*/
+class FrameRing
+{
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        GstSample*          sample;
+        GstClockTime        base_time;  // base time of the sink the sample came from, see VideoFrame::captureTime
+    };
+
+    const RingPolicy        m_policy;
+    const size_t            m_mask;
+    std::unique_ptr<Cell[]> m_cells;
+
+    // producer and consumer positions live on separate cache lines so they don't false share
+    char                    m_pad0[64];
+    std::atomic<size_t>     m_enqueue_pos;
+    char                    m_pad1[64];
+    std::atomic<size_t>     m_dequeue_pos;
+    char                    m_pad2[64];
+
+    BlockPoolPtr            m_frames;       // memory for the views handed out by tryPopFrame
+    std::atomic<bool>       m_closed;
+    std::atomic<guint64>    m_pushed;
+    std::atomic<guint64>    m_popped;
+    std::atomic<guint64>    m_dropped_oldest;
+    std::atomic<guint64>    m_dropped_newest;
+    std::atomic<guint64>    m_blocked;
+
+    /**
+    @brief rounds up to the next power of two
+    @param value value to round. 0 and 1 give 2
+    @returns See above
+    */
+    static size_t roundCapacity(size_t value)
+    {
+        size_t capacity = 2;
+        while(capacity < value)
+            capacity <<= 1;
+        return capacity;
+    }
+    /**
+    @brief stores the sample if a slot is free
+    @param sample sample to store
+    @param base_time base time of the sink
+    @returns false if the ring is full
+    */
+    bool tryEnqueue(GstSample* sample, const GstClockTime base_time)
+    {
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+        for(;;)
+        {
+            cell = &m_cells[pos & m_mask];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if(diff == 0)
+            {
+                if(m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(diff < 0)
+                return false;
+            else
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+        cell->sample = sample;
+        cell->base_time = base_time;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    /**
+    @brief takes the oldest sample if there is one
+    @param sample receives the sample
+    @param base_time receives the base time stored with it
+    @returns false if the ring is empty
+    */
+    bool tryDequeue(GstSample*& sample, GstClockTime& base_time)
+    {
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+        for(;;)
+        {
+            cell = &m_cells[pos & m_mask];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if(diff == 0)
+            {
+                if(m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(diff < 0)
+                return false;
+            else
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+        sample = cell->sample;
+        base_time = cell->base_time;
+        cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+public:
+    /**
+    @brief allocates every slot up front
+    @param capacity number of samples the ring holds. Rounded up to a power of two
+    @param policy what to do when the ring is full
+    */
+    explicit FrameRing(const size_t capacity, const RingPolicy policy = RingPolicy::DROP_OLDEST)
+        : m_policy(policy), m_mask(roundCapacity(capacity) - 1), m_cells(new Cell[m_mask + 1]),
+          m_pad0(), m_enqueue_pos(0), m_pad1(), m_dequeue_pos(0), m_pad2(),
+          m_frames(std::make_shared<BlockPool>()), m_closed(false), m_pushed(0), m_popped(0), m_dropped_oldest(0), m_dropped_newest(0), m_blocked(0)
+    {
+        for(size_t i = 0; i <= m_mask; i++)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+            m_cells[i].sample = NULL;
+            m_cells[i].base_time = GST_CLOCK_TIME_NONE;
+        }
+    }
+    /**
+    @brief releases every sample still queued
+    */
+    ~FrameRing()
+    {
+        GstSample* sample;
+        GstClockTime base_time;
+        while(tryDequeue(sample, base_time))
+            gst_sample_unref(sample);
+    }
+
+    FrameRing(FrameRing&&) = delete;
+    FrameRing(const FrameRing&) = delete;
+    /**
+    @brief queues a sample according to the ring policy
+    @param sample sample to queue. The ring takes ownership of the reference, also when it is dropped
+    @param base_time base time of the sink the sample came from, so popped frames know their capture time
+    @returns true if the sample was queued, false if it was dropped or the ring was closed
+    */
+    bool push(GstSample* sample, const GstClockTime base_time = GST_CLOCK_TIME_NONE)
+    {
+        if(G_UNLIKELY(m_closed.load(std::memory_order_relaxed)))
+        {
+            gst_sample_unref(sample);
+            return false;
+        }
+
+        if(G_LIKELY(tryEnqueue(sample, base_time)))
+        {
+            m_pushed.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        switch(m_policy)
+        {
+            case RingPolicy::DROP_NEWEST:
+                gst_sample_unref(sample);
+                m_dropped_newest.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            case RingPolicy::DROP_OLDEST:
+                do
+                {
+                    GstSample* oldest;
+                    GstClockTime oldest_base_time;
+                    if(tryDequeue(oldest, oldest_base_time))
+                    {
+                        gst_sample_unref(oldest);
+                        m_dropped_oldest.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+                while(!tryEnqueue(sample, base_time));
+                break;
+            case RingPolicy::BLOCK:
+                m_blocked.fetch_add(1, std::memory_order_relaxed);
+                do
+                {
+                    if(m_closed.load(std::memory_order_relaxed))
+                    {
+                        gst_sample_unref(sample);
+                        return false;
+                    }
+                    std::this_thread::yield();
+                }
+                while(!tryEnqueue(sample, base_time));
+                break;
+        }
+        m_pushed.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    /**
+    @brief takes the oldest queued sample. Never blocks
+    @param sample receives the sample. The caller owns the reference
+    @returns false if the ring was empty
+    */
+    bool tryPop(GstSample*& sample)
+    {
+        GstClockTime base_time;
+        return tryPop(sample, base_time);
+    }
+    /**
+    @brief See tryPop
+    @param sample receives the sample. The caller owns the reference
+    @param base_time receives the base time the sample was pushed with
+    @returns false if the ring was empty
+    */
+    bool tryPop(GstSample*& sample, GstClockTime& base_time)
+    {
+        if(!tryDequeue(sample, base_time))
+            return false;
+        m_popped.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    /**
+    @brief takes the oldest queued sample and maps it. The mapping happens on the calling thread, not the streaming thread
+    @returns the mapped frame, NULL if the ring was empty or the sample could not be mapped
+    */
+    VideoFramePtr tryPopFrame()
+    {
+        GstSample* sample;
+        GstClockTime base_time;
+        if(!tryPop(sample, base_time))
+            return VideoFramePtr();
+
+        VideoFramePtr frame = makePooled<VideoFrame>(m_frames, sample, base_time);
+        return frame->isMapped() ? frame : VideoFramePtr();
+    }
+    /**
+    @brief rejects every further push and wakes producers waiting under RingPolicy::BLOCK. Queued samples can still be popped
+    */
+    void close()
+    {
+        m_closed.store(true, std::memory_order_relaxed);
+    }
+    /**
+    @returns the approximate number of queued samples
+    */
+    size_t size() const
+    {
+        const size_t enqueue = m_enqueue_pos.load(std::memory_order_relaxed);
+        const size_t dequeue = m_dequeue_pos.load(std::memory_order_relaxed);
+        return enqueue > dequeue ? enqueue - dequeue : 0;
+    }
+    /**
+    @returns number of samples the ring holds
+    */
+    size_t capacity() const
+    {
+        return m_mask + 1;
+    }
+    /**
+    @returns the full ring policy
+    */
+    RingPolicy policy() const
+    {
+        return m_policy;
+    }
+    /**
+    @returns a snapshot of the ring counters
+    */
+    RingStats stats() const
+    {
+        RingStats stats;
+        stats.pushed = m_pushed.load(std::memory_order_relaxed);
+        stats.popped = m_popped.load(std::memory_order_relaxed);
+        stats.dropped_oldest = m_dropped_oldest.load(std::memory_order_relaxed);
+        stats.dropped_newest = m_dropped_newest.load(std::memory_order_relaxed);
+        stats.blocked = m_blocked.load(std::memory_order_relaxed);
+        return stats;
+    }
+};
+
+
+typedef std::shared_ptr<FrameRing> FrameRingPtr;
+
+
+#endif // FRAME_RING_H
@@ -0,0 +1,275 @@
+#ifndef FRAME_SYNC_H
+#define FRAME_SYNC_H
+
+#include <gst/gst.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "VideoFrame.h"
+
+
+
+
+/**
+@brief one frame of a synchronized set
+*/
+struct SyncedFrame
+{
+    std::string   stream;           // id of the stream the frame came from
+    VideoFramePtr frame;
+    GstClockTime  capture_time;     // see VideoFrame::captureTime
+};
+
+
+typedef std::vector<SyncedFrame> FrameSet;
+
+
+/**
+@brief counters kept by a FrameSynchronizer
+*/
+struct SyncStats
+{
+    guint64 frames;         // frames added to a history
+    guint64 unstamped;      // frames dropped because they carried no capture time
+    guint64 queries;        // nearest and latest calls
+    guint64 complete;       // queries that found a frame of every stream within the tolerance
+};
+
+
+
+
+/**
+@brief keeps the last few frames of several streams by capture time and answers which frames of every stream were captured
+closest to one instant. Streams must deliver frames with a capture time, see StreamConfig::wallclock.
+History is kept per stream, ordered by capture time, and bounded by depth. Every frame it holds pins a decoded buffer,
+keep the depth small with decoders that have a fixed number of output surfaces
+*/
+class FrameSynchronizer
+{
+private:
+    struct History
+    {
+        std::string              stream;
+        std::deque<SyncedFrame>  frames;    // oldest first
+    };
+
+    const std::string       m_name;
+    const size_t            m_depth;
+
+    mutable std::mutex      m_mutex;
+    std::vector<History>    m_histories;
+
+    std::atomic<guint64>    m_frames;
+    std::atomic<guint64>    m_unstamped;
+    mutable std::atomic<guint64> m_queries;
+    mutable std::atomic<guint64> m_complete;
+
+    /**
+    @returns the history of the stream, NULL if the stream isn't an input. m_mutex must be held
+    */
+    History* findHistory(const std::string& stream)
+    {
+        for(History& history : m_histories)
+        {
+            if(history.stream == stream)
+                return &history;
+        }
+        return NULL;
+    }
+    /**
+    @brief adds a frame to the history of its stream, dropping the oldest one past the depth
+    @param stream stream id
+    @param frame frame to add
+    */
+    void push(const std::string& stream, const VideoFramePtr& frame)
+    {
+        const GstClockTime capture_time = frame->captureTime();
+        if(!GST_CLOCK_TIME_IS_VALID(capture_time))
+        {
+            m_unstamped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        History* history = findHistory(stream);
+        if(G_UNLIKELY(history == NULL))
+            return;
+
+        // frames arrive in capture order unless the sender clock mapping jumped, search from the back
+        auto position = history->frames.end();
+        while(position != history->frames.begin() && std::prev(position)->capture_time > capture_time)
+            --position;
+        history->frames.insert(position, {stream, frame, capture_time});
+        if(history->frames.size() > m_depth)
+            history->frames.pop_front();
+        m_frames.fetch_add(1, std::memory_order_relaxed);
+    }
+    /**
+    @param history history to search, not empty
+    @param time capture time to look for
+    @returns the frame of the history captured closest to time
+    */
+    static const SyncedFrame& closest(const History& history, const GstClockTime time)
+    {
+        auto after = std::lower_bound(history.frames.begin(), history.frames.end(), time,
+                                      [](const SyncedFrame& frame, const GstClockTime value){ return frame.capture_time < value; });
+        if(after == history.frames.end())
+            return history.frames.back();
+        if(after == history.frames.begin())
+            return *after;
+        auto before = std::prev(after);
+        return time - before->capture_time <= after->capture_time - time ? *before : *after;
+    }
+    /**
+    @brief See nearest. m_mutex must be held
+    */
+    bool collect(const GstClockTime time, const GstClockTime tolerance, FrameSet& set) const
+    {
+        set.clear();
+        for(const History& history : m_histories)
+        {
+            if(history.frames.empty())
+                continue;
+            const SyncedFrame& frame = closest(history, time);
+            const GstClockTime distance = frame.capture_time > time ? frame.capture_time - time : time - frame.capture_time;
+            if(distance <= tolerance)
+                set.push_back(frame);
+        }
+
+        m_queries.fetch_add(1, std::memory_order_relaxed);
+        const bool complete = !m_histories.empty() && set.size() == m_histories.size();
+        if(complete)
+            m_complete.fetch_add(1, std::memory_order_relaxed);
+        return complete;
+    }
+
+public:
+    /**
+    @param name name of the synchronizer, used as the metrics label
+    @param depth frames kept per stream
+    */
+    explicit FrameSynchronizer(const std::string& name, const size_t depth = 8)
+        : m_name(name), m_depth(std::max<size_t>(depth, 1)), m_mutex(), m_histories(),
+          m_frames(0), m_unstamped(0), m_queries(0), m_complete(0)
+    {}
+
+    FrameSynchronizer(FrameSynchronizer&&) = delete;
+    FrameSynchronizer(const FrameSynchronizer&) = delete;
+    /**
+    @brief adds a stream to the synchronized sets
+    @param stream stream id. Adding the same id twice returns a callback feeding the same history
+    @returns frame callback to set as StreamConfig::on_frame. It holds a pointer to the synchronizer, which must outlive the stream
+    */
+    frame_callback input(const std::string& stream)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if(findHistory(stream) == NULL)
+                m_histories.push_back({stream, std::deque<SyncedFrame>()});
+        }
+        return [this, stream](const VideoFramePtr& frame){ push(stream, frame); };
+    }
+    /**
+    @brief removes a stream and releases its history. Frames it still delivers are dropped
+    @param stream stream id
+    */
+    void removeInput(const std::string& stream)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_histories.erase(std::remove_if(m_histories.begin(), m_histories.end(), [&stream](const History& history){ return history.stream == stream; }),
+                          m_histories.end());
+    }
+    /**
+    @brief finds the frame of every stream captured closest to time
+    @param time capture time, nanoseconds since the unix epoch
+    @param tolerance largest distance between time and the capture time of a frame in the set
+    @param set receives one frame per stream that has one within the tolerance, in the order the streams were added
+    @returns true if every stream contributed a frame
+    */
+    bool nearest(const GstClockTime time, const GstClockTime tolerance, FrameSet& set) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return collect(time, tolerance, set);
+    }
+    /**
+    @brief finds the newest set. Looks for the newest instant every stream has delivered a frame for,
+    which is the oldest of the newest frames of the streams, see nearest
+    @param tolerance largest distance between that instant and the capture time of a frame in the set
+    @param set receives the frames
+    @returns true if every stream contributed a frame
+    */
+    bool latest(const GstClockTime tolerance, FrameSet& set) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        GstClockTime time = GST_CLOCK_TIME_NONE;
+        for(const History& history : m_histories)
+        {
+            if(history.frames.empty())
+            {
+                set.clear();
+                m_queries.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            time = std::min(time, history.frames.back().capture_time);
+        }
+        return collect(time, tolerance, set);
+    }
+    /**
+    @returns the synchronizer name
+    */
+    const std::string& name() const
+    {
+        return m_name;
+    }
+    /**
+    @returns a snapshot of the synchronizer counters
+    */
+    SyncStats stats() const
+    {
+        SyncStats stats;
+        stats.frames = m_frames.load(std::memory_order_relaxed);
+        stats.unstamped = m_unstamped.load(std::memory_order_relaxed);
+        stats.queries = m_queries.load(std::memory_order_relaxed);
+        stats.complete = m_complete.load(std::memory_order_relaxed);
+        return stats;
+    }
+    /**
+    @brief writes the synchronizer metrics in the prometheus text format, without HELP and TYPE lines. See writePrometheusHeaders
+    @param stream output stream
+    @param labels label set of every sample, EG sync="tracker"
+    */
+    void writePrometheus(std::ostream& stream, const std::string& labels) const
+    {
+        const SyncStats sync = stats();
+        stream << "rtsp_sync_frames_total{" << labels << ",outcome=\"kept\"} " << sync.frames << '\n'
+               << "rtsp_sync_frames_total{" << labels << ",outcome=\"unstamped\"} " << sync.unstamped << '\n'
+               << "rtsp_sync_queries_total{" << labels << ",outcome=\"complete\"} " << sync.complete << '\n'
+               << "rtsp_sync_queries_total{" << labels << ",outcome=\"partial\"} " << sync.queries - sync.complete << '\n';
+    }
+    /**
+    @brief writes the HELP and TYPE lines of every synchronizer metric
+    @param stream output stream
+    */
+    static void writePrometheusHeaders(std::ostream& stream)
+    {
+        stream << "# HELP rtsp_sync_frames_total Frames by outcome, kept in a history or dropped without a capture time.\n"
+               << "# TYPE rtsp_sync_frames_total counter\n"
+               << "# HELP rtsp_sync_queries_total Frame set queries by whether every stream had a frame within the tolerance.\n"
+               << "# TYPE rtsp_sync_queries_total counter\n";
+    }
+};
+
+
+typedef std::shared_ptr<FrameSynchronizer> FrameSynchronizerPtr;
+
+
+#endif // FRAME_SYNC_H
@@ -0,0 +1,1116 @@
+#ifndef GSTREAM_PIPELINE_H
+#define GSTREAM_PIPELINE_H
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+
+#include <string>
+#include <iostream>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <set>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "EncodedFrame.h"
+#include "FactoryCache.h"
+#include "FramePool.h"
+#include "FrameRing.h"
+#include "Instrumentation.h"
+#include "LatencyProfile.h"
+#include "PipelineSpec.h"
+#include "VideoFrame.h"
+
+
+typedef std::function<void(bool reached)> state_callback;
+
+
+
+
+class GStreamPipeline
+{
+private:
+    typedef std::pair<GstElement*, GstCaps*> gstream_pair;
+    typedef std::map<std::string, gstream_pair> gstream_map;
+
+    gstream_map m_pipeline_map;
+    GstElement* m_pipeline;
+    GMainLoop*  m_loop;
+    GSource*    m_bus_source;
+    GstBusFunc  m_bus_callback;
+    gpointer    m_bus_user_data;
+
+    // state change waiting for completion, set by changeState and finished from the bus
+    std::mutex     m_state_mutex;
+    GstState       m_state_target;
+    state_callback m_state_callback;
+    std::set<std::string> m_removed_elements;
+    /**
+    @brief user callback of an appsink together with the memory its frame views are allocated from
+    */
+    template<typename Callback>
+    struct SinkCallback
+    {
+        Callback     callback;
+        BlockPoolPtr frames;
+    };
+
+    std::map<std::string, std::unique_ptr<SinkCallback<frame_callback>>> m_frame_callbacks;
+    std::map<std::string, std::unique_ptr<SinkCallback<encoded_callback>>> m_encoded_callbacks;
+    std::map<std::string, std::unique_ptr<SinkBufferPool>> m_sink_pools;
+    std::string m_pipeline_name;
+    std::unique_ptr<PipelineInstrumentation> m_instrumentation;
+
+    /**
+    @brief appsink new-sample callback. Hands the pulled sample to the user callback without copying it
+    @param sink appsink that has a sample ready
+    @param user_data SinkCallback to invoke
+    @returns GST_FLOW_EOS if the sink is flushing or at EOS, GST_FLOW_OK otherwise
+    */
+    static GstFlowReturn onNewSample(GstAppSink* sink, gpointer user_data)
+    {
+        GstSample* sample = gst_app_sink_pull_sample(sink);
+        if(G_UNLIKELY(sample == NULL))
+            return GST_FLOW_EOS;
+
+        SinkCallback<frame_callback>* sink_callback = static_cast<SinkCallback<frame_callback>*>(user_data);
+        VideoFramePtr frame = makePooled<VideoFrame>(sink_callback->frames, sample, gst_element_get_base_time(GST_ELEMENT(sink)));
+        if(G_LIKELY(frame->isMapped()))
+            sink_callback->callback(frame);
+        return GST_FLOW_OK;
+    }
+    /**
+    @brief appsink new-sample callback. Hands the pulled access unit to the user callback without copying it
+    @param sink appsink that has a sample ready
+    @param user_data SinkCallback to invoke
+    @returns GST_FLOW_EOS if the sink is flushing or at EOS, GST_FLOW_OK otherwise
+    */
+    static GstFlowReturn onNewEncodedSample(GstAppSink* sink, gpointer user_data)
+    {
+        GstSample* sample = gst_app_sink_pull_sample(sink);
+        if(G_UNLIKELY(sample == NULL))
+            return GST_FLOW_EOS;
+
+        SinkCallback<encoded_callback>* sink_callback = static_cast<SinkCallback<encoded_callback>*>(user_data);
+        EncodedFramePtr frame = makePooled<EncodedFrame>(sink_callback->frames, sample);
+        if(G_LIKELY(frame->isMapped()))
+            sink_callback->callback(frame);
+        return GST_FLOW_OK;
+    }
+    /**
+    @brief appsink new-sample callback. Moves the pulled sample reference into a FrameRing without mapping it
+    @param sink appsink that has a sample ready
+    @param user_data FrameRing to push to
+    @returns GST_FLOW_EOS if the sink is flushing or at EOS, GST_FLOW_OK otherwise
+    */
+    static GstFlowReturn onNewSampleToRing(GstAppSink* sink, gpointer user_data)
+    {
+        GstSample* sample = gst_app_sink_pull_sample(sink);
+        if(G_UNLIKELY(sample == NULL))
+            return GST_FLOW_EOS;
+
+        static_cast<FrameRing*>(user_data)->push(sample, gst_element_get_base_time(GST_ELEMENT(sink)));
+        return GST_FLOW_OK;
+    }
+
+    /**
+    @brief bus watch installed by attachBusWatch. Tracks state changes, then hands the message to the user callback
+    @param bus pipeline bus
+    @param message message to handle
+    @param user_data GStreamPipeline
+    @returns what the user callback returns, TRUE without one
+    */
+    static gboolean onBusMessage(GstBus* bus, GstMessage* message, gpointer user_data)
+    {
+        GStreamPipeline* pipeline = static_cast<GStreamPipeline*>(user_data);
+        pipeline->trackState(message);
+        return pipeline->m_bus_callback != NULL ? pipeline->m_bus_callback(bus, message, pipeline->m_bus_user_data) : TRUE;
+    }
+    /**
+    @brief finishes the pending state change when the pipeline settles in the target state or fails
+    @param message bus message
+    */
+    void trackState(GstMessage* message)
+    {
+        bool reached;
+        switch(GST_MESSAGE_TYPE(message))
+        {
+            case GST_MESSAGE_STATE_CHANGED:
+            {
+                if(GST_MESSAGE_SRC(message) != GST_OBJECT(m_pipeline))
+                    return;
+                GstState old_state, new_state, pending;
+                gst_message_parse_state_changed(message, &old_state, &new_state, &pending);
+                std::lock_guard<std::mutex> lock(m_state_mutex);
+                if(new_state != m_state_target || pending != GST_STATE_VOID_PENDING)
+                    return;
+                reached = true;
+                break;
+            }
+            case GST_MESSAGE_ERROR:
+                reached = false;
+                break;
+            default:
+                return;
+        }
+        finishState(reached);
+    }
+    /**
+    @brief invokes and clears the pending state callback
+    @param reached true if the target state was reached
+    */
+    void finishState(const bool reached)
+    {
+        state_callback callback;
+        {
+            std::lock_guard<std::mutex> lock(m_state_mutex);
+            callback.swap(m_state_callback);
+            m_state_target = GST_STATE_VOID_PENDING;
+        }
+        if(callback)
+            callback(reached);
+    }
+    /**
+    @brief creates a gstreame element
+    @param element Gstelement to link
+    @param caps caps filter can be NULL
+    @param child_element child to link
+    @param element_name element name
+    @param child_element_name child_element_name
+    @return true on success false on failure
+    */
+    bool linkElement(GstElement* element, GstCaps* caps, GstElement* child_element, const std::string& element_name, const std::string& child_element_name)
+    {
+        if(G_UNLIKELY(!GST_IS_ELEMENT(element)))
+        {
+            std::cout << "Failed to link: " << element_name << " was the pipeline created?\n";
+            return false;
+        }
+        if(G_UNLIKELY(!GST_IS_ELEMENT(child_element)))
+        {
+            std::cout << "Failed to link " << element_name << " to " << child_element_name << " was the pipeline created?\n";
+            return false;
+        }
+        if(GST_IS_CAPS(caps))
+        {
+            if(G_UNLIKELY(!gst_element_link_filtered(element, child_element, caps)))
+            {
+                gchar* tmp_str = gst_caps_to_string(caps);
+                std::cout << "Failed to link " << element_name << " to " << child_element_name <<  " with caps: " << tmp_str << '\n';
+                g_free(tmp_str);
+                return false;
+            }
+            return true;
+        }
+        else if(G_UNLIKELY(!gst_element_link(element, child_element)))
+        {
+            std::cout << "Failed to link " << element_name << " to " << child_element_name << '\n'; 
+            return false;
+        }
+        return true;
+    }
+    /**
+    @brief creates a gstream element 
+    @param element gstElement plugin name
+    @param element_name element name
+    @param pipe to attach
+    @returns contructed element or NULL on failure
+    */
+    GstElement* createElement(const std::string& element, const std::string& element_name, GstElement* pipe)
+    {   
+        GstElement* output;
+
+        if(G_UNLIKELY(pipe == NULL))
+            return NULL;
+    
+        if (G_UNLIKELY (!(output = FactoryCache::instance().create(element, element_name)))) 
+            return NULL;
+    
+        if (G_UNLIKELY (!gst_bin_add (GST_BIN_CAST (pipe), output))) 
+        {
+            gst_object_unref(G_OBJECT(output));
+            return NULL;
+        } 
+        return output;
+    }
+
+public:
+    /**
+    @brief constructs a pipeline with the provided arguments
+    @param pipeline_name name of the pipeline to construct
+    @param init_gstream initialize gstreamer in constructor?
+    @param create_main_loop create a GMainLoop in constructor? 
+    */
+    GStreamPipeline(const std::string& pipeline_name, const bool init_gstream = true, const bool create_main_loop = true)
+        : m_pipeline_map(), m_pipeline(NULL), m_loop(NULL), m_bus_source(NULL), m_bus_callback(NULL), m_bus_user_data(NULL),
+          m_state_mutex(), m_state_target(GST_STATE_VOID_PENDING), m_state_callback(), m_removed_elements(), m_frame_callbacks(), m_encoded_callbacks(), m_sink_pools(),
+          m_pipeline_name(pipeline_name), m_instrumentation()
+    {
+        if(init_gstream)
+            gst_init(NULL, NULL);
+        if(create_main_loop)
+            m_loop = g_main_loop_new(NULL, FALSE);
+        
+        m_pipeline = GST_ELEMENT(gst_object_ref_sink(gst_pipeline_new(pipeline_name.c_str())));
+    }
+    /**
+    @brief removes the bus watch, stops the pipeline and releases it
+    */
+    ~GStreamPipeline()
+    {
+        if(m_bus_source != NULL)
+        {
+            g_source_destroy(m_bus_source);
+            g_source_unref(m_bus_source);
+        }
+        if(m_pipeline != NULL)
+        {
+            gst_element_set_state(m_pipeline, GST_STATE_NULL);
+            m_instrumentation.reset();
+            gst_object_unref(m_pipeline);
+        }
+        for(auto& element : m_pipeline_map)
+        {
+            if(m_removed_elements.count(element.first) != 0)
+                gst_object_unref(element.second.first);
+            if(element.second.second != NULL)
+                gst_caps_unref(element.second.second);
+        }
+        if(m_loop != NULL)
+            g_main_loop_unref(m_loop);
+    }
+
+    GStreamPipeline(GStreamPipeline&&) = delete;
+    GStreamPipeline(const GStreamPipeline&) = delete;
+    /**
+    @brief adds an element to the pipeline
+    @param element GstElement plugin name
+    @param element_name element_name
+    @returns true on success false on failure
+    */
+    bool addElement(const std::string& element, const std::string& element_name)
+    {
+        GstElement* new_element = createElement(element, element_name, m_pipeline); 
+        if(G_UNLIKELY(!GST_IS_ELEMENT(new_element)))
+        {
+            std::cout << "Failed to add element with name " << element << '\n';
+            return false;
+        }
+        m_pipeline_map[element_name] = {new_element, NULL};
+        return true;
+    }
+    /**
+    @brief adds a element to the pipeline
+    @param element GstElement plugin name
+    @param element_name element_name
+    @param element_caps element_caps string
+    */
+    bool addElement(const std::string& element, const std::string& element_name, const std::string& element_caps)
+    {
+        GstCaps* caps = gst_caps_from_string(element_caps.c_str());
+        if(G_UNLIKELY(!GST_IS_CAPS(caps)))
+        {
+            std::cout << "Failed to create element caps with string " << element_caps << '\n';
+            return false;
+        }
+        GstElement* new_element = createElement(element, element_name, m_pipeline); 
+        if(G_UNLIKELY(!GST_IS_ELEMENT(new_element)))
+        {
+            std::cout << "Failed to add element with name " << element << '\n';
+            gst_caps_unref(caps);
+            return false;
+        }
+        m_pipeline_map[element_name] = {new_element, caps};
+        return true;
+    }
+    /**
+    @brief validates a spec and builds it in one pass. Every factory, property value, caps string and link target is
+    checked before anything is added, so a failed build leaves the pipeline untouched. Links use the created elements
+    directly instead of looking them up by name
+    @param spec pipeline description
+    @param error receives the reason of a failure. can be NULL
+    @returns true on success false on failure
+    */
+    bool build(const PipelineSpec& spec, std::string* error = NULL)
+    {
+        struct Built
+        {
+            GstElement* element;
+            GstCaps*    caps;
+        };
+        std::map<std::string, Built> built;
+        std::string reason;
+
+        auto release = [&built]()
+        {
+            for(auto& entry : built)
+            {
+                gst_object_unref(entry.second.element);
+                if(entry.second.caps != NULL)
+                    gst_caps_unref(entry.second.caps);
+            }
+        };
+
+        for(const ElementSpec& element_spec : spec.elements)
+        {
+            if(built.count(element_spec.name) != 0 || m_pipeline_map.count(element_spec.name) != 0)
+            {
+                reason = "duplicate element name " + element_spec.name;
+                break;
+            }
+
+            GstElement* element = FactoryCache::instance().create(element_spec.factory, element_spec.name);
+            if(element == NULL)
+            {
+                reason = "no element " + element_spec.factory + " for " + element_spec.name;
+                break;
+            }
+
+            GstCaps* caps = element_spec.caps.empty() ? NULL : gst_caps_from_string(element_spec.caps.c_str());
+            built[element_spec.name] = {GST_ELEMENT(gst_object_ref_sink(element)), caps};
+            if(!element_spec.caps.empty() && caps == NULL)
+            {
+                reason = "invalid caps " + element_spec.caps + " on " + element_spec.name;
+                break;
+            }
+
+            for(const PropertySpec& property : element_spec.properties)
+            {
+                GParamSpec* param = g_object_class_find_property(G_OBJECT_GET_CLASS(element), property.name.c_str());
+                if(param == NULL)
+                {
+                    if(property.optional)
+                        continue;
+                    reason = element_spec.name + " has no property " + property.name;
+                    break;
+                }
+
+                GValue value = G_VALUE_INIT;
+                g_value_init(&value, G_PARAM_SPEC_VALUE_TYPE(param));
+                const bool parsed = (param->flags & G_PARAM_WRITABLE) && gst_value_deserialize(&value, property.value.c_str());
+                if(parsed)
+                    g_object_set_property(G_OBJECT(element), property.name.c_str(), &value);
+                g_value_unset(&value);
+                if(!parsed)
+                {
+                    reason = "invalid value " + property.value + " for " + element_spec.name + "::" + property.name;
+                    break;
+                }
+            }
+            if(!reason.empty())
+                break;
+        }
+
+        // resolve every link up front, names may also refer to elements already in the pipeline
+        std::vector<std::vector<std::pair<std::string, Built>>> links;
+        for(size_t i = 0; reason.empty() && i < spec.chains.size(); i++)
+        {
+            links.emplace_back();
+            for(const std::string& name : spec.chains[i])
+            {
+                auto created = built.find(name);
+                auto existing = m_pipeline_map.find(name);
+                if(created != built.end())
+                    links.back().push_back({name, created->second});
+                else if(existing != m_pipeline_map.end() && m_removed_elements.count(name) == 0)
+                    links.back().push_back({name, Built{existing->second.first, existing->second.second}});
+                else
+                {
+                    reason = "link to unknown element " + name;
+                    break;
+                }
+            }
+        }
+
+        if(!reason.empty())
+        {
+            std::cout << "Failed to build pipeline " << m_pipeline_name << ": " << reason << '\n';
+            if(error != NULL)
+                *error = reason;
+            release();
+            return false;
+        }
+
+        // all or nothing, the map only ever holds elements the bin owns and a failed build leaves the pipeline as it was
+        std::vector<GstElement*> added;
+        for(auto& entry : built)
+        {
+            if(G_UNLIKELY(!gst_bin_add(GST_BIN(m_pipeline), entry.second.element)))
+            {
+                reason = "failed to add " + entry.first + " to the pipeline";
+                break;
+            }
+            added.push_back(entry.second.element);
+        }
+
+        // link before anything reaches the map, so a failed link can still be taken back
+        std::vector<std::pair<GstElement*, GstElement*>> linked;
+        for(size_t i = 0; reason.empty() && i < links.size(); i++)
+        {
+            const auto& chain = links[i];
+            for(size_t j = 0; j + 1 < chain.size(); j++)
+            {
+                if(!linkElement(chain[j].second.element, chain[j].second.caps, chain[j + 1].second.element, chain[j].first, chain[j + 1].first))
+                {
+                    reason = "failed to link " + chain[j].first + " to " + chain[j + 1].first;
+                    break;
+                }
+                linked.push_back({chain[j].second.element, chain[j + 1].second.element});
+            }
+        }
+
+        if(!reason.empty())
+        {
+            std::cout << "Failed to build pipeline " << m_pipeline_name << ": " << reason << '\n';
+            if(error != NULL)
+                *error = reason;
+            // links between elements that were already in the pipeline don't go away with the removed elements
+            for(auto link = linked.rbegin(); link != linked.rend(); ++link)
+                gst_element_unlink(link->first, link->second);
+            for(GstElement* element : added)
+                gst_bin_remove(GST_BIN(m_pipeline), element);
+            release();
+            return false;
+        }
+        for(auto& entry : built)
+        {
+            gst_object_unref(entry.second.element);
+            m_pipeline_map[entry.first] = {entry.second.element, entry.second.caps};
+        }
+        return true;
+    }
+    /**
+    @brief sets the caps used when linking the element to the next one. Replaces previous caps
+    @param element_name element name
+    @param element_caps element_caps string
+    @returns true if the element exists and the caps were parsed
+    */
+    bool setElementCaps(const std::string& element_name, const std::string& element_caps)
+    {
+        auto found = m_pipeline_map.find(element_name);
+        if(found == m_pipeline_map.end())
+            return false;
+
+        GstCaps* caps = gst_caps_from_string(element_caps.c_str());
+        if(G_UNLIKELY(!GST_IS_CAPS(caps)))
+        {
+            std::cout << "Failed to create element caps with string " << element_caps << '\n';
+            return false;
+        }
+        if(found->second.second != NULL)
+            gst_caps_unref(found->second.second);
+        found->second.second = caps;
+        return true;
+    }
+    /**
+    @brief takes elements out of the pipeline without destroying them. They are set to NULL, keep their properties
+    and callbacks and stay addressable by name. The bin unlinks every pad of a removed element
+    @param element_names elements to remove
+    @returns true if every element was removed
+    */
+    bool removeElements(const std::vector<std::string>& element_names)
+    {
+        for(const std::string& name : element_names)
+        {
+            auto found = m_pipeline_map.find(name);
+            if(found == m_pipeline_map.end() || m_removed_elements.count(name) != 0)
+                return false;
+
+            GstElement* element = found->second.first;
+            gst_object_ref(element);
+            gst_element_set_state(element, GST_STATE_NULL);
+            if(G_UNLIKELY(!gst_bin_remove(GST_BIN(m_pipeline), element)))
+            {
+                gst_object_unref(element);
+                return false;
+            }
+            m_removed_elements.insert(name);
+        }
+        return true;
+    }
+    /**
+    @brief puts elements taken out by removeElements back into the pipeline. They still need to be linked and have their state synced
+    @param element_names elements to restore
+    @returns true if every element was restored
+    */
+    bool restoreElements(const std::vector<std::string>& element_names)
+    {
+        for(const std::string& name : element_names)
+        {
+            auto found = m_pipeline_map.find(name);
+            if(found == m_pipeline_map.end() || m_removed_elements.count(name) == 0)
+                return false;
+
+            GstElement* element = found->second.first;
+            if(G_UNLIKELY(!gst_bin_add(GST_BIN(m_pipeline), element)))
+                return false;
+            gst_object_unref(element);
+            m_removed_elements.erase(name);
+        }
+        return true;
+    }
+    /**
+    @brief replaces an element with a fresh instance from the same factory, keeping its name and link caps.
+    The old element is set to NULL and destroyed, which unlinks it. The new one still needs its properties set,
+    its pads linked and its state synced
+    @param element_name element to replace
+    @returns true if the element was replaced
+    */
+    bool recreateElement(const std::string& element_name)
+    {
+        auto found = m_pipeline_map.find(element_name);
+        if(found == m_pipeline_map.end() || m_removed_elements.count(element_name) != 0)
+            return false;
+
+        GstElement* old_element = found->second.first;
+        GstElement* new_element = gst_element_factory_create(gst_element_get_factory(old_element), element_name.c_str());
+        if(G_UNLIKELY(new_element == NULL))
+        {
+            std::cout << "Failed to recreate element with name " << element_name << '\n';
+            return false;
+        }
+
+        gst_element_set_state(old_element, GST_STATE_NULL);
+        gst_bin_remove(GST_BIN(m_pipeline), old_element);
+        if(G_UNLIKELY(!gst_bin_add(GST_BIN(m_pipeline), new_element)))
+        {
+            gst_object_unref(new_element);
+            if(found->second.second != NULL)
+                gst_caps_unref(found->second.second);
+            m_pipeline_map.erase(found);
+            return false;
+        }
+        found->second.first = new_element;
+        return true;
+    }
+    /** 
+    @brief Links the elements by list of name
+    @param element_name list of nanes
+    @return if successfully linked 
+    */
+    bool linkElementsByName(const std::vector<std::string>& element_names)
+    {
+        for(auto begin = element_names.begin(); begin != element_names.end(); begin++)
+        {
+            if(begin + 1 == element_names.end())
+                break;
+            
+            auto found = m_pipeline_map.find(*begin);
+            auto child_found = m_pipeline_map.find(*(begin + 1));
+
+            if(found == m_pipeline_map.end())
+            {
+                std::cout << "Failed to link elements. Could not find element by name: " << *begin << '\n';
+                return false;
+            }
+            if(child_found == m_pipeline_map.end())
+            {
+                std::cout << "Failed to link elements. Could not find child element by name: " << *begin++;
+                return false;
+            }
+
+            gstream_pair parent_pair = found->second;
+            gstream_pair child_pair = child_found->second;
+
+            if(!linkElement(parent_pair.first, parent_pair.second, child_pair.first, found->first, child_found->first))
+                return false;
+        }
+        return true; 
+    }
+    /**
+    @brief Sets the element signal to supplied callback
+    @param element element name
+    @param signal_name name of the signal to attach the callback to
+    @param callback function callback
+    @param user_data user data. can be NULL
+    @returns true if the signal was set correctly. Doesn't guaranteed the Element was actually set because the API doesn't have any way to check  
+    */
+    bool setElementSignal(const std::string& element_name, const std::string& signal_name, GCallback callback, gpointer user_data)
+    {
+        auto found = m_pipeline_map.find(element_name);
+        if(found == m_pipeline_map.end())
+            return false;
+        
+        GstElement* element = std::get<GstElement*>(found->second);
+        if(!GST_IS_ELEMENT(element))
+            return false;
+        
+        g_signal_connect(G_OBJECT(element), signal_name.c_str(), G_CALLBACK (callback), user_data);
+	return true;
+    }
+    /**
+    @brief Sets the element property to the provided value
+    @param element elements name
+    @param propery_name the properties name the value will be set to
+    @param propery_value the value to set
+    @return true if the elements property was set correctly. Doesn't guaranteed the property was actually set because the API doesn't have any way to check  
+    */
+    template<typename T>
+    bool setElementProperty(const std::string& element_name, const std::string& property_name, T property_value)
+    {
+        auto found = m_pipeline_map.find(element_name);
+        if(found == m_pipeline_map.end())
+            return false;
+        
+        GstElement* element = std::get<GstElement*>(found->second);
+        if(!GST_IS_ELEMENT(element))
+            return false;
+        
+        g_object_set(G_OBJECT(element), property_name.c_str(), property_value, NULL);
+	return true;
+    }
+    /**
+    @param element_name element name
+    @param property_name property to look for
+    @returns true if the element exists and has the property
+    */
+    bool hasElementProperty(const std::string& element_name, const std::string& property_name)
+    {
+        GstElement* element = getElementByName(element_name);
+        return element != NULL && g_object_class_find_property(G_OBJECT_GET_CLASS(element), property_name.c_str()) != NULL;
+    }
+    /**
+    @brief configures the jitterbuffer of an rtspsrc, the threading of a decoder and the clock sync of sinks.
+    Properties an element doesn't have are skipped, so hardware decoders and sinks without sync are left alone
+    @param settings settings to apply
+    @param source_name rtspsrc element, empty to skip
+    @param decoder_name decoder element, empty to skip
+    @param sink_names sink elements
+    */
+    void applyLatencySettings(const LatencySettings& settings, const std::string& source_name, const std::string& decoder_name,
+                              const std::vector<std::string>& sink_names)
+    {
+        if(!source_name.empty())
+        {
+            setElementProperty(source_name, "latency", settings.latency_ms);
+            setElementProperty(source_name, "drop-on-latency", static_cast<gboolean>(settings.drop_on_latency));
+            setElementProperty(source_name, "do-retransmission", static_cast<gboolean>(settings.do_retransmission));
+            setElementProperty(source_name, "buffer-mode", settings.buffer_mode);
+        }
+
+        if(!decoder_name.empty() && hasElementProperty(decoder_name, "max-threads"))
+        {
+            // slice threading adds no delay. Without a thread-type property (libav before 1.18) the only way to avoid frame threading is a single thread
+            if(settings.frame_threading)
+                setElementProperty(decoder_name, "max-threads", settings.decoder_threads);
+            else if(hasElementProperty(decoder_name, "thread-type"))
+            {
+                setElementProperty(decoder_name, "thread-type", 2u);
+                setElementProperty(decoder_name, "max-threads", settings.decoder_threads);
+            }
+            else
+                setElementProperty(decoder_name, "max-threads", 1);
+        }
+
+        for(const std::string& sink : sink_names)
+        {
+            if(hasElementProperty(sink, "sync"))
+                setElementProperty(sink, "sync", static_cast<gboolean>(settings.sink_sync));
+        }
+    }
+    /**
+    @brief delivers every decoded frame reaching the appsink to the callback.
+    Frames are handed out as mapped views of the pipeline's own buffers, nothing is copied.
+    The callback runs on the streaming thread, so hold on to the VideoFramePtr rather than doing heavy work in it.
+    Install the callback before the pipeline leaves the NULL state
+    @param appsink_name name of an appsink element added with addElement
+    @param callback function invoked for every frame
+    @returns true if the callback was installed
+    */
+    bool setFrameCallback(const std::string& appsink_name, frame_callback callback)
+    {
+        auto found = m_pipeline_map.find(appsink_name);
+        if(found == m_pipeline_map.end())
+            return false;
+
+        GstElement* element = found->second.first;
+        if(!GST_IS_APP_SINK(element))
+        {
+            std::cout << "Failed to set frame callback. " << appsink_name << " is not an appsink\n";
+            return false;
+        }
+
+        std::unique_ptr<SinkCallback<frame_callback>>& stored = m_frame_callbacks[appsink_name];
+        stored.reset(new SinkCallback<frame_callback>());
+        stored->callback = std::move(callback);
+        stored->frames = std::make_shared<BlockPool>();
+
+        GstAppSinkCallbacks callbacks = GstAppSinkCallbacks();
+        callbacks.new_sample = onNewSample;
+        gst_app_sink_set_callbacks(GST_APP_SINK(element), &callbacks, stored.get(), NULL);
+        return true;
+    }
+    /**
+    @brief delivers every compressed access unit reaching the appsink to the callback, with its timestamps and keyframe flag.
+    The callback runs on the streaming thread. Install the callback before the pipeline leaves the NULL state
+    @param appsink_name name of an appsink element added with addElement
+    @param callback function invoked for every access unit
+    @returns true if the callback was installed
+    */
+    bool setEncodedCallback(const std::string& appsink_name, encoded_callback callback)
+    {
+        auto found = m_pipeline_map.find(appsink_name);
+        if(found == m_pipeline_map.end())
+            return false;
+
+        GstElement* element = found->second.first;
+        if(!GST_IS_APP_SINK(element))
+        {
+            std::cout << "Failed to set encoded callback. " << appsink_name << " is not an appsink\n";
+            return false;
+        }
+
+        std::unique_ptr<SinkCallback<encoded_callback>>& stored = m_encoded_callbacks[appsink_name];
+        stored.reset(new SinkCallback<encoded_callback>());
+        stored->callback = std::move(callback);
+        stored->frames = std::make_shared<BlockPool>();
+
+        GstAppSinkCallbacks callbacks = GstAppSinkCallbacks();
+        callbacks.new_sample = onNewEncodedSample;
+        gst_app_sink_set_callbacks(GST_APP_SINK(element), &callbacks, stored.get(), NULL);
+        return true;
+    }
+    /**
+    @brief makes the element in front of the appsink render into a GstBufferPool of preallocated video buffers,
+    so steady state delivery performs no allocation per frame. Install it before the pipeline leaves the NULL state
+    @param appsink_name name of an appsink element added with addElement
+    @param min_buffers buffers to preallocate. Size it to every frame that can be alive at once, ring slots included
+    @returns true if the pool was installed, false if the sink already has one
+    */
+    bool setBufferPool(const std::string& appsink_name, const guint min_buffers)
+    {
+        auto found = m_pipeline_map.find(appsink_name);
+        if(found == m_pipeline_map.end() || !GST_IS_APP_SINK(found->second.first) || m_sink_pools.count(appsink_name) != 0)
+            return false;
+
+        std::unique_ptr<SinkBufferPool>& stored = m_sink_pools[appsink_name];
+        stored.reset(new SinkBufferPool(min_buffers));
+        return stored->install(found->second.first);
+    }
+    /**
+    @returns bytes preallocated by every buffer pool installed with setBufferPool
+    */
+    gsize bufferPoolBytes()
+    {
+        gsize bytes = 0;
+        for(auto& pool : m_sink_pools)
+            bytes += pool.second->bytes();
+        return bytes;
+    }
+    /**
+    @brief queues every sample reaching the appsink into the ring. Consumers pop from the ring on their own threads.
+    Install the ring before the pipeline leaves the NULL state
+    @param appsink_name name of an appsink element added with addElement
+    @param ring ring to push to. Must outlive the pipeline
+    @returns true if the ring was installed
+    */
+    bool setFrameRing(const std::string& appsink_name, FrameRing* ring)
+    {
+        auto found = m_pipeline_map.find(appsink_name);
+        if(found == m_pipeline_map.end() || ring == NULL)
+            return false;
+
+        GstElement* element = found->second.first;
+        if(!GST_IS_APP_SINK(element))
+        {
+            std::cout << "Failed to set frame ring. " << appsink_name << " is not an appsink\n";
+            return false;
+        }
+
+        GstAppSinkCallbacks callbacks = GstAppSinkCallbacks();
+        callbacks.new_sample = onNewSampleToRing;
+        gst_app_sink_set_callbacks(GST_APP_SINK(element), &callbacks, ring, NULL);
+        return true;
+    }
+    /**
+    @brief installs buffer probes on the pads of every element added so far and starts collecting per element
+    latency, fps and byte rate. Call it once after the pipeline is built
+    @returns false if instrumentation was already enabled
+    */
+    bool enableInstrumentation()
+    {
+        if(m_instrumentation)
+            return false;
+
+        m_instrumentation.reset(new PipelineInstrumentation());
+        for(auto& element : m_pipeline_map)
+            m_instrumentation->addElement(element.second.first, element.first);
+        return true;
+    }
+    /**
+    @returns the instrumentation, NULL if it was never enabled
+    */
+    const PipelineInstrumentation* instrumentation() const
+    {
+        return m_instrumentation.get();
+    }
+    /**
+    @returns a snapshot of every instrumented element, empty if instrumentation is disabled
+    */
+    std::vector<ElementStats> elementStats() const
+    {
+        return m_instrumentation ? m_instrumentation->stats() : std::vector<ElementStats>();
+    }
+    /**
+    @returns the element stats as a JSON object, empty if instrumentation is disabled
+    */
+    std::string statsToJson() const
+    {
+        return m_instrumentation ? m_instrumentation->toJson(m_pipeline_name) : std::string();
+    }
+    /**
+    @returns the element stats in Prometheus text format, empty if instrumentation is disabled
+    */
+    std::string statsToPrometheus() const
+    {
+        return m_instrumentation ? m_instrumentation->toPrometheus(m_pipeline_name) : std::string();
+    }
+    /**
+    @returns the name the pipeline was constructed with
+    */
+    const std::string& getPipelineName() const
+    {
+        return m_pipeline_name;
+    }
+    /**
+    @brief returns the first element factory in the list that is present in the registry. gstreamer must be initialized
+    @param factory_names candidate plugin names in order of preference
+    @returns the factory name, empty if none of them are available
+    */
+    static std::string findAvailableFactory(const std::vector<std::string>& factory_names)
+    {
+        for(const std::string& name : factory_names)
+        {
+            if(FactoryCache::instance().find(name) != NULL)
+                return name;
+        }
+        return std::string();
+    }
+    /**
+    @brief Returns the GstElement by name
+    @param element_name the GstElement name
+    @returns See above
+    */
+    GstElement* getElementByName(const std::string& element_name)
+    {
+        auto found = m_pipeline_map.find(element_name);
+        return found != m_pipeline_map.end() ? found->second.first : NULL;
+    }
+    /**
+    @brief looks an element up through the bin instead of the element map, so it is safe from any thread
+    @param element_name the GstElement name
+    @returns a new reference to the element, NULL if the pipeline has none by that name
+    */
+    GstElement* findElement(const std::string& element_name)
+    {
+        return gst_bin_get_by_name(GST_BIN(m_pipeline), element_name.c_str());
+    }
+    /**
+    @brief calls func for every element of the pipeline, recursing into bins such as rtspsrc. Walks the bin instead of the
+    element map, so it is safe from any thread. An element added or removed meanwhile stops the walk early
+    @param func called with a GValue holding the element
+    @param user_data user data passed to func. can be NULL
+    */
+    void forEachElement(GstIteratorForeachFunction func, gpointer user_data)
+    {
+        GstIterator* elements = gst_bin_iterate_recurse(GST_BIN(m_pipeline));
+        gst_iterator_foreach(elements, func, user_data);
+        gst_iterator_free(elements);
+    }
+    /**
+    @brief Runs the main loop
+    */
+    void runMainLoop()
+    {
+        g_main_loop_run(m_loop);
+    }   
+    /**
+    @brief quits the main loop if it is running
+    */
+    void quitMainLoop()
+    {
+        if(m_loop != NULL)
+            g_main_loop_quit(m_loop);
+    }
+    /**
+    @brief dispatches the pipeline bus messages on the given context. Replaces any previous watch.
+    The watch also completes changeState, so state callbacks only fire while a watch is attached
+    @param context context to dispatch on. NULL for the default context
+    @param callback invoked for every message on the thread running the context
+    @param user_data user data. can be NULL
+    @returns true if the watch was attached
+    */
+    bool attachBusWatch(GMainContext* context, GstBusFunc callback, gpointer user_data)
+    {
+        if(m_bus_source != NULL)
+        {
+            g_source_destroy(m_bus_source);
+            g_source_unref(m_bus_source);
+            m_bus_source = NULL;
+        }
+
+        GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(m_pipeline));
+        if(G_UNLIKELY(bus == NULL))
+            return false;
+
+        GSource* source = gst_bus_create_watch(bus);
+        gst_object_unref(bus);
+        if(G_UNLIKELY(source == NULL))
+            return false;
+
+        m_bus_callback = callback;
+        m_bus_user_data = user_data;
+        g_source_set_callback(source, (GSourceFunc) onBusMessage, this, NULL);
+        g_source_attach(source, context);
+        m_bus_source = source;
+        return true;
+    }
+    /**
+    @brief installs a handler called for every message on the thread that posted it, before the bus watch sees it.
+    Replaces any previous handler
+    @param handler handler. Must return GST_BUS_PASS so the watch still receives the message
+    @param user_data user data. can be NULL
+    @returns true if the handler was installed
+    */
+    bool setSyncHandler(GstBusSyncHandler handler, gpointer user_data)
+    {
+        GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(m_pipeline));
+        if(G_UNLIKELY(bus == NULL))
+            return false;
+
+        gst_bus_set_sync_handler(bus, handler, user_data, NULL);
+        gst_object_unref(bus);
+        return true;
+    }
+    /**
+    @brief sets the element state
+    @param element_name
+    @param element_state 
+    @returns if the state was set
+    */
+    bool setElementState(const std::string& element_name, GstState state)
+    {
+        auto found = m_pipeline_map.find(element_name);
+        if(found == m_pipeline_map.end())
+            return false;
+
+        return gst_element_set_state(found->second.first, state) != GST_STATE_CHANGE_FAILURE;
+    }
+    /**
+    @brief runs the pipeline on a realtime system clock instead of the monotonic one, so base time plus running time is wall clock time.
+    Call it before the pipeline leaves the NULL state
+    */
+    void useRealtimeClock()
+    {
+        GstClock* clock = GST_CLOCK(g_object_new(GST_TYPE_SYSTEM_CLOCK, "clock-type", GST_CLOCK_TYPE_REALTIME, NULL));
+        gst_pipeline_use_clock(GST_PIPELINE(m_pipeline), clock);
+        gst_object_unref(clock);
+    }
+    /**
+    @brief brings elements built into a running pipeline up to its state. Downstream first, so nothing is pushed into an element that isn't running yet
+    @param spec spec the elements were built from. Elements that were taken out of the pipeline again are skipped
+    @returns false if an element failed to change state
+    */
+    bool syncElementStates(const PipelineSpec& spec)
+    {
+        bool synced = true;
+        for(auto it = spec.elements.rbegin(); it != spec.elements.rend(); ++it)
+        {
+            GstElement* element = getElementByName(it->name);
+            if(element != NULL && GST_OBJECT_PARENT(element) == GST_OBJECT(m_pipeline) && !gst_element_sync_state_with_parent(element))
+                synced = false;
+        }
+        return synced;
+    }
+    /**
+    @brief sets the pipeline state
+    @param state pipeline state to set
+    @returns if the state was set
+    */
+    bool setPipelineState(GstState state)
+    {
+        return gst_element_set_state(m_pipeline, state) != GST_STATE_CHANGE_FAILURE;
+    }
+    /**
+    @brief changes the pipeline state and reports when the change completed. A change that finishes synchronously
+    is reported before returning, an async one when the pipeline posts its final state change on the bus.
+    A new change replaces a pending one, which is reported as not reached
+    @param state pipeline state to set
+    @param callback called once with true when the state is reached, false on failure or error. can be empty
+    @returns false if the state change failed right away
+    */
+    bool changeState(const GstState state, state_callback callback)
+    {
+        finishState(false);
+        {
+            std::lock_guard<std::mutex> lock(m_state_mutex);
+            m_state_target = state;
+            m_state_callback = std::move(callback);
+        }
+
+        const GstStateChangeReturn result = gst_element_set_state(m_pipeline, state);
+        if(result == GST_STATE_CHANGE_FAILURE)
+        {
+            finishState(false);
+            return false;
+        }
+        // live sources answer NO_PREROLL, both that and SUCCESS mean the state is already reached
+        if(result != GST_STATE_CHANGE_ASYNC)
+        {
+            GstState current = GST_STATE_VOID_PENDING;
+            gst_element_get_state(m_pipeline, &current, NULL, 0);
+            if(current == state)
+                finishState(true);
+        }
+        return true;
+    }
+    /**
+    @brief See changeState
+    @param state pipeline state to set
+    @returns future holding true once the state is reached, false on failure
+    */
+    std::future<bool> changeStateFuture(const GstState state)
+    {
+        std::shared_ptr<std::promise<bool>> promise = std::make_shared<std::promise<bool>>();
+        std::future<bool> future = promise->get_future();
+        changeState(state, [promise](bool reached){ promise->set_value(reached); });
+        return future;
+    }
+    /**
+    @brief redistributes the pipeline latency. Call it when the bus posts a LATENCY message
+    @returns false if the latency could not be configured
+    */
+    bool recalculateLatency()
+    {
+        return gst_bin_recalculate_latency(GST_BIN(m_pipeline));
+    }
+    /**
+    @returns the current pipeline state, ignoring a change in progress
+    */
+    GstState currentState()
+    {
+        GstState current = GST_STATE_VOID_PENDING;
+        gst_element_get_state(m_pipeline, &current, NULL, 0);
+        return current;
+    }
+    /**
+    @brief attaches the pipeline to a bin
+    @returns attached bin, or NULL if failed
+    */
+    GstElement* attachToBin()
+    {
+        GstElement* bin = gst_bin_new(NULL);
+        if(!gst_bin_add(GST_BIN(bin), m_pipeline))
+        {
+            gst_object_unref(bin);
+            return NULL;
+        }
+        return bin;
+    }
+};
+
+
+#endif // GSTREAM_PIPELINE_H
@@ -0,0 +1,507 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <gst/gst.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+
+
+/**
+@brief lock free latency histogram with power of two microsecond buckets.
+Bucket i counts samples in [2^i, 2^(i+1)) us, the last bucket also holds everything above it
+*/
+class LatencyHistogram
+{
+public:
+    static const size_t BUCKETS = 24;
+
+private:
+    std::atomic<guint64> m_buckets[BUCKETS];
+    std::atomic<guint64> m_count;
+    std::atomic<guint64> m_sum_us;
+    std::atomic<guint64> m_max_us;
+
+public:
+    LatencyHistogram()
+        : m_count(0), m_sum_us(0), m_max_us(0)
+    {
+        for(size_t i = 0; i < BUCKETS; i++)
+            m_buckets[i].store(0, std::memory_order_relaxed);
+    }
+
+    LatencyHistogram(LatencyHistogram&&) = delete;
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    /**
+    @brief records a sample
+    @param latency_us latency in microseconds
+    */
+    void record(const guint64 latency_us)
+    {
+        size_t bucket = 0;
+        while(bucket + 1 < BUCKETS && (latency_us >> (bucket + 1)) != 0)
+            bucket++;
+
+        m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum_us.fetch_add(latency_us, std::memory_order_relaxed);
+
+        guint64 max = m_max_us.load(std::memory_order_relaxed);
+        while(latency_us > max && !m_max_us.compare_exchange_weak(max, latency_us, std::memory_order_relaxed))
+            ;
+    }
+    /**
+    @param bucket bucket index
+    @returns number of samples in the bucket
+    */
+    guint64 bucketCount(const size_t bucket) const
+    {
+        return m_buckets[bucket].load(std::memory_order_relaxed);
+    }
+    /**
+    @param bucket bucket index
+    @returns exclusive upper bound of the bucket in microseconds
+    */
+    static guint64 bucketUpperBound(const size_t bucket)
+    {
+        return G_GUINT64_CONSTANT(1) << (bucket + 1);
+    }
+    /**
+    @returns number of recorded samples
+    */
+    guint64 count() const
+    {
+        return m_count.load(std::memory_order_relaxed);
+    }
+    /**
+    @returns sum of every recorded sample in microseconds
+    */
+    guint64 sumUs() const
+    {
+        return m_sum_us.load(std::memory_order_relaxed);
+    }
+    /**
+    @returns largest recorded sample in microseconds
+    */
+    guint64 maxUs() const
+    {
+        return m_max_us.load(std::memory_order_relaxed);
+    }
+    /**
+    @brief estimates a percentile from the buckets
+    @param fraction percentile as a fraction, EG 0.99
+    @returns upper bound of the bucket holding the percentile in microseconds, 0 if empty
+    */
+    guint64 percentileUs(const double fraction) const
+    {
+        const guint64 total = count();
+        if(total == 0)
+            return 0;
+
+        const guint64 target = static_cast<guint64>(fraction * total + 0.5);
+        guint64 seen = 0;
+        for(size_t i = 0; i < BUCKETS; i++)
+        {
+            seen += bucketCount(i);
+            if(seen >= target && seen != 0)
+                return bucketUpperBound(i);
+        }
+        return bucketUpperBound(BUCKETS - 1);
+    }
+    /**
+    @brief writes the histogram samples in Prometheus text exposition format, in seconds
+    @param stream stream to write to
+    @param metric metric name without the _bucket, _sum and _count suffixes
+    @param labels labels shared by every sample
+    */
+    void writePrometheus(std::ostream& stream, const std::string& metric, const std::string& labels) const
+    {
+        guint64 cumulative = 0;
+        for(size_t i = 0; i < BUCKETS; i++)
+        {
+            cumulative += bucketCount(i);
+            if(i + 1 < BUCKETS)
+                stream << metric << "_bucket{" << labels << ",le=\"" << bucketUpperBound(i) / 1e6 << "\"} " << cumulative << '\n';
+        }
+        stream << metric << "_bucket{" << labels << ",le=\"+Inf\"} " << cumulative << '\n'
+               << metric << "_sum{" << labels << "} " << sumUs() / 1e6 << '\n'
+               << metric << "_count{" << labels << "} " << cumulative << '\n';
+    }
+};
+
+
+
+
+/**
+@brief snapshot of the counters kept for one element
+*/
+struct ElementStats
+{
+    std::string name;
+    guint64     buffers_in;
+    guint64     buffers_out;
+    guint64     bytes_in;
+    guint64     bytes_out;
+    double      fps;                // output buffers per second since instrumentation started
+    double      bytes_per_second;   // output bytes per second since instrumentation started
+    guint64     latency_count;      // number of buffers matched between the sink and src pads
+    double      latency_mean_us;
+    guint64     latency_p50_us;
+    guint64     latency_p95_us;
+    guint64     latency_p99_us;
+    guint64     latency_max_us;
+};
+
+
+
+
+/**
+@brief buffer probes on every pad of one element.
+Time spent inside the element is measured by matching the PTS of buffers leaving the src pads with buffers that entered the sink pads
+*/
+class ElementProbe
+{
+private:
+    static const size_t PTS_SLOTS = 32;
+
+    struct PtsEntry
+    {
+        GstClockTime pts;
+        gint64       time_us;
+    };
+    typedef std::pair<GstPad*, gulong> probe_pair;
+
+    std::string             m_name;
+    std::vector<probe_pair> m_probes;
+    gint64                  m_start_us;
+
+    std::atomic<guint64>    m_buffers_in;
+    std::atomic<guint64>    m_buffers_out;
+    std::atomic<guint64>    m_bytes_in;
+    std::atomic<guint64>    m_bytes_out;
+    LatencyHistogram        m_latency;
+
+    std::mutex              m_pts_mutex;
+    PtsEntry                m_pts[PTS_SLOTS];
+    size_t                  m_pts_next;
+
+    /**
+    @brief counts the buffers and bytes carried by the probe
+    @param info probe info
+    @param buffers receives the number of buffers
+    @param bytes receives the number of bytes
+    @returns the first buffer, NULL if there was none
+    */
+    static GstBuffer* probeBuffer(GstPadProbeInfo* info, guint64& buffers, guint64& bytes)
+    {
+        if(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+        {
+            GstBufferList* list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+            buffers = gst_buffer_list_length(list);
+            bytes = gst_buffer_list_calculate_size(list);
+            return buffers != 0 ? gst_buffer_list_get(list, 0) : NULL;
+        }
+        GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        buffers = 1;
+        bytes = gst_buffer_get_size(buffer);
+        return buffer;
+    }
+    /**
+    @brief sink pad probe. Remembers when the buffer entered the element
+    */
+    static GstPadProbeReturn onSinkBuffer(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+    {
+        ElementProbe* probe = static_cast<ElementProbe*>(user_data);
+        guint64 buffers, bytes;
+        GstBuffer* buffer = probeBuffer(info, buffers, bytes);
+
+        probe->m_buffers_in.fetch_add(buffers, std::memory_order_relaxed);
+        probe->m_bytes_in.fetch_add(bytes, std::memory_order_relaxed);
+
+        if(buffer != NULL && GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer)))
+        {
+            std::lock_guard<std::mutex> lock(probe->m_pts_mutex);
+            PtsEntry& entry = probe->m_pts[probe->m_pts_next++ % PTS_SLOTS];
+            entry.pts = GST_BUFFER_PTS(buffer);
+            entry.time_us = g_get_monotonic_time();
+        }
+        return GST_PAD_PROBE_OK;
+    }
+    /**
+    @brief src pad probe. Records how long the matching input buffer spent in the element
+    */
+    static GstPadProbeReturn onSrcBuffer(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+    {
+        ElementProbe* probe = static_cast<ElementProbe*>(user_data);
+        guint64 buffers, bytes;
+        GstBuffer* buffer = probeBuffer(info, buffers, bytes);
+
+        probe->m_buffers_out.fetch_add(buffers, std::memory_order_relaxed);
+        probe->m_bytes_out.fetch_add(bytes, std::memory_order_relaxed);
+
+        if(buffer == NULL || !GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer)))
+            return GST_PAD_PROBE_OK;
+
+        const GstClockTime pts = GST_BUFFER_PTS(buffer);
+        gint64 entered_us = -1;
+        {
+            std::lock_guard<std::mutex> lock(probe->m_pts_mutex);
+            // newest first, so a frame split over several input buffers is timed from its last piece
+            for(size_t i = 1; i <= PTS_SLOTS && i <= probe->m_pts_next; i++)
+            {
+                const PtsEntry& entry = probe->m_pts[(probe->m_pts_next - i) % PTS_SLOTS];
+                if(entry.pts == pts)
+                {
+                    entered_us = entry.time_us;
+                    break;
+                }
+            }
+        }
+        if(entered_us >= 0)
+            probe->m_latency.record(static_cast<guint64>(g_get_monotonic_time() - entered_us));
+        return GST_PAD_PROBE_OK;
+    }
+    /**
+    @brief installs the probe matching the pad direction
+    @param item GValue holding the pad
+    @param user_data ElementProbe
+    */
+    static void addPadProbe(const GValue* item, gpointer user_data)
+    {
+        ElementProbe* probe = static_cast<ElementProbe*>(user_data);
+        GstPad* pad = GST_PAD(g_value_get_object(item));
+        const GstPadProbeType type = static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST);
+
+        gulong id = 0;
+        if(gst_pad_get_direction(pad) == GST_PAD_SINK)
+            id = gst_pad_add_probe(pad, type, onSinkBuffer, probe, NULL);
+        else if(gst_pad_get_direction(pad) == GST_PAD_SRC)
+            id = gst_pad_add_probe(pad, type, onSrcBuffer, probe, NULL);
+
+        if(id != 0)
+            probe->m_probes.push_back({GST_PAD(gst_object_ref(pad)), id});
+    }
+
+public:
+    /**
+    @brief installs probes on every pad the element currently has
+    @param element element to instrument
+    @param name name reported in the stats
+    */
+    ElementProbe(GstElement* element, const std::string& name)
+        : m_name(name), m_probes(), m_start_us(g_get_monotonic_time()),
+          m_buffers_in(0), m_buffers_out(0), m_bytes_in(0), m_bytes_out(0), m_latency(),
+          m_pts_mutex(), m_pts(), m_pts_next(0)
+    {
+        GstIterator* pads = gst_element_iterate_pads(element);
+        gst_iterator_foreach(pads, addPadProbe, this);
+        gst_iterator_free(pads);
+    }
+    /**
+    @brief removes the probes
+    */
+    ~ElementProbe()
+    {
+        for(probe_pair& probe : m_probes)
+        {
+            gst_pad_remove_probe(probe.first, probe.second);
+            gst_object_unref(probe.first);
+        }
+    }
+
+    ElementProbe(ElementProbe&&) = delete;
+    ElementProbe(const ElementProbe&) = delete;
+    /**
+    @returns a snapshot of the element counters
+    */
+    ElementStats stats() const
+    {
+        ElementStats stats;
+        stats.name = m_name;
+        stats.buffers_in = m_buffers_in.load(std::memory_order_relaxed);
+        stats.buffers_out = m_buffers_out.load(std::memory_order_relaxed);
+        stats.bytes_in = m_bytes_in.load(std::memory_order_relaxed);
+        stats.bytes_out = m_bytes_out.load(std::memory_order_relaxed);
+
+        const double elapsed = (g_get_monotonic_time() - m_start_us) / static_cast<double>(G_USEC_PER_SEC);
+        stats.fps = elapsed > 0.0 ? stats.buffers_out / elapsed : 0.0;
+        stats.bytes_per_second = elapsed > 0.0 ? stats.bytes_out / elapsed : 0.0;
+
+        stats.latency_count = m_latency.count();
+        stats.latency_mean_us = stats.latency_count != 0 ? m_latency.sumUs() / static_cast<double>(stats.latency_count) : 0.0;
+        stats.latency_p50_us = m_latency.percentileUs(0.50);
+        stats.latency_p95_us = m_latency.percentileUs(0.95);
+        stats.latency_p99_us = m_latency.percentileUs(0.99);
+        stats.latency_max_us = m_latency.maxUs();
+        return stats;
+    }
+    /**
+    @returns the element latency histogram
+    */
+    const LatencyHistogram& latency() const
+    {
+        return m_latency;
+    }
+    /**
+    @returns the element name
+    */
+    const std::string& name() const
+    {
+        return m_name;
+    }
+};
+
+
+
+
+/**
+@brief pad probes on every element of a pipeline, plus JSON and Prometheus text export
+*/
+class PipelineInstrumentation
+{
+private:
+    std::vector<std::unique_ptr<ElementProbe>> m_probes;
+
+public:
+    /**
+    @brief escapes a string for a JSON string or a Prometheus label value
+    @param value string to escape
+    @returns See above
+    */
+    static std::string escape(const std::string& value)
+    {
+        std::string output;
+        output.reserve(value.size());
+        for(const char c : value)
+        {
+            if(c == '"' || c == '\\')
+                output += '\\';
+            output += c;
+        }
+        return output;
+    }
+
+    PipelineInstrumentation()
+        : m_probes()
+    {}
+
+    PipelineInstrumentation(PipelineInstrumentation&&) = delete;
+    PipelineInstrumentation(const PipelineInstrumentation&) = delete;
+    /**
+    @brief instruments an element
+    @param element element to instrument
+    @param name name reported in the stats
+    */
+    void addElement(GstElement* element, const std::string& name)
+    {
+        m_probes.emplace_back(new ElementProbe(element, name));
+    }
+    /**
+    @returns a snapshot of every instrumented element
+    */
+    std::vector<ElementStats> stats() const
+    {
+        std::vector<ElementStats> output;
+        output.reserve(m_probes.size());
+        for(const auto& probe : m_probes)
+            output.push_back(probe->stats());
+        return output;
+    }
+    /**
+    @brief writes the stats as a JSON object
+    @param stream stream to write to
+    @param pipeline_name name reported for the pipeline
+    */
+    void writeJson(std::ostream& stream, const std::string& pipeline_name) const
+    {
+        stream << "{\"pipeline\":\"" << escape(pipeline_name) << "\",\"elements\":[";
+        bool first = true;
+        for(const ElementStats& element : stats())
+        {
+            if(!first)
+                stream << ',';
+            first = false;
+
+            stream << "{\"name\":\"" << escape(element.name) << '"'
+                   << ",\"buffers_in\":" << element.buffers_in
+                   << ",\"buffers_out\":" << element.buffers_out
+                   << ",\"bytes_in\":" << element.bytes_in
+                   << ",\"bytes_out\":" << element.bytes_out
+                   << ",\"fps\":" << element.fps
+                   << ",\"bytes_per_second\":" << element.bytes_per_second
+                   << ",\"latency_us\":{\"count\":" << element.latency_count
+                   << ",\"mean\":" << element.latency_mean_us
+                   << ",\"p50\":" << element.latency_p50_us
+                   << ",\"p95\":" << element.latency_p95_us
+                   << ",\"p99\":" << element.latency_p99_us
+                   << ",\"max\":" << element.latency_max_us << "}}";
+        }
+        stream << "]}";
+    }
+    /**
+    @brief writes the Prometheus metric family headers. Write them once before the samples of every pipeline
+    @param stream stream to write to
+    */
+    static void writePrometheusHeaders(std::ostream& stream)
+    {
+        stream << "# HELP rtsp_element_buffers_total Buffers seen on the element pads.\n"
+               << "# TYPE rtsp_element_buffers_total counter\n"
+               << "# HELP rtsp_element_bytes_total Bytes seen on the element pads.\n"
+               << "# TYPE rtsp_element_bytes_total counter\n"
+               << "# HELP rtsp_element_latency_seconds Time buffers spend inside the element.\n"
+               << "# TYPE rtsp_element_latency_seconds histogram\n";
+    }
+    /**
+    @brief writes the samples in Prometheus text exposition format
+    @param stream stream to write to
+    @param pipeline_name value of the pipeline label
+    */
+    void writePrometheus(std::ostream& stream, const std::string& pipeline_name) const
+    {
+        const std::string pipeline_label = "pipeline=\"" + escape(pipeline_name) + "\"";
+        for(const auto& probe : m_probes)
+        {
+            const ElementStats element = probe->stats();
+            const LatencyHistogram& latency = probe->latency();
+            const std::string labels = pipeline_label + ",element=\"" + escape(element.name) + "\"";
+
+            stream << "rtsp_element_buffers_total{" << labels << ",direction=\"in\"} " << element.buffers_in << '\n'
+                   << "rtsp_element_buffers_total{" << labels << ",direction=\"out\"} " << element.buffers_out << '\n'
+                   << "rtsp_element_bytes_total{" << labels << ",direction=\"in\"} " << element.bytes_in << '\n'
+                   << "rtsp_element_bytes_total{" << labels << ",direction=\"out\"} " << element.bytes_out << '\n';
+            latency.writePrometheus(stream, "rtsp_element_latency_seconds", labels);
+        }
+    }
+    /**
+    @param pipeline_name name reported for the pipeline
+    @returns the stats as a JSON object
+    */
+    std::string toJson(const std::string& pipeline_name) const
+    {
+        std::ostringstream stream;
+        writeJson(stream, pipeline_name);
+        return stream.str();
+    }
+    /**
+    @param pipeline_name value of the pipeline label
+    @returns the stats in Prometheus text exposition format, headers included
+    */
+    std::string toPrometheus(const std::string& pipeline_name) const
+    {
+        std::ostringstream stream;
+        writePrometheusHeaders(stream);
+        writePrometheus(stream, pipeline_name);
+        return stream.str();
+    }
+};
+
+
+#endif // INSTRUMENTATION_H
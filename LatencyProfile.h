@@ -0,0 +1,70 @@
+#ifndef LATENCY_PROFILE_H
+#define LATENCY_PROFILE_H
+
+#include <gst/gst.h>
+
+
+
+
+/**
+@brief presets trading latency against robustness to network jitter
+*/
+enum class LatencyProfile
+{
+    LOW_LATENCY,    // smallest jitterbuffer that survives a LAN, late packets are dropped and frames are shown as soon as they decode
+    SMOOTH          // enough buffering to ride out WAN jitter and retransmissions, frames are shown on their timestamps
+};
+
+
+
+
+/**
+@brief jitterbuffer, decoder and sink settings applied by GStreamPipeline::applyLatencySettings
+*/
+struct LatencySettings
+{
+    guint latency_ms;           // rtpjitterbuffer latency. 0 makes reordered packets arrive as losses
+    bool  drop_on_latency;      // drop packets that would make the jitterbuffer hold more than latency_ms
+    bool  do_retransmission;    // request retransmission of lost packets. Only worth it when latency_ms covers a round trip
+    gint  buffer_mode;          // rtpjitterbuffer buffer-mode. 0 none, 1 slave, 2 buffer, 4 synced
+    gint  decoder_threads;      // decoder max-threads, 0 uses one per core
+    bool  frame_threading;      // allow frame threading, which delays output by one frame per thread
+    bool  sink_sync;            // render on the buffer timestamps instead of as soon as frames arrive
+
+    LatencySettings()
+        : latency_ms(200), drop_on_latency(false), do_retransmission(false), buffer_mode(1), decoder_threads(0), frame_threading(true), sink_sync(true)
+    {}
+};
+
+
+/**
+@param profile profile
+@returns the settings of the profile
+*/
+inline LatencySettings latencySettings(const LatencyProfile profile)
+{
+    LatencySettings settings;
+    switch(profile)
+    {
+        case LatencyProfile::LOW_LATENCY:
+            settings.latency_ms = 40;
+            settings.drop_on_latency = true;
+            settings.do_retransmission = false;
+            settings.decoder_threads = 0;
+            settings.frame_threading = false;
+            settings.sink_sync = false;
+            break;
+        case LatencyProfile::SMOOTH:
+            settings.latency_ms = 400;
+            settings.drop_on_latency = false;
+            settings.do_retransmission = true;
+            settings.decoder_threads = 0;
+            settings.frame_threading = true;
+            settings.sink_sync = true;
+            break;
+    }
+    return settings;
+}
+
+
+#endif // LATENCY_PROFILE_H
@@ -0,0 +1,138 @@
+#ifndef PIPELINE_SPEC_H
+#define PIPELINE_SPEC_H
+
+#include <deque>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+
+
+
+/**
+@brief a property assignment. The value is parsed for the property type when the spec is built,
+so enums take their nick and flags take their nicks joined with +
+*/
+struct PropertySpec
+{
+    std::string name;
+    std::string value;
+    bool        optional;   // skipped when the element has no such property instead of failing the build
+};
+
+
+
+
+/**
+@brief one element of a PipelineSpec
+*/
+class ElementSpec
+{
+public:
+    std::string               factory;    // plugin feature name, EG rtspsrc
+    std::string               name;       // element name, unique in the pipeline
+    std::string               caps;       // caps used when linking this element to the next one. Empty links unfiltered
+    std::vector<PropertySpec> properties;
+
+    ElementSpec(const std::string& factory_name, const std::string& element_name)
+        : factory(factory_name), name(element_name), caps(), properties()
+    {}
+    /**
+    @brief sets a property from its serialized form
+    @param property_name property name
+    @param value serialized value
+    @param optional skip the property if the element doesn't have it
+    @returns the spec, for chaining
+    */
+    ElementSpec& property(const std::string& property_name, const std::string& value, const bool optional = false)
+    {
+        properties.push_back({property_name, value, optional});
+        return *this;
+    }
+    /**
+    @brief See above
+    */
+    ElementSpec& property(const std::string& property_name, const char* value, const bool optional = false)
+    {
+        return property(property_name, std::string(value), optional);
+    }
+    /**
+    @brief See above
+    */
+    ElementSpec& property(const std::string& property_name, const bool value, const bool optional = false)
+    {
+        return property(property_name, std::string(value ? "true" : "false"), optional);
+    }
+    /**
+    @brief See above
+    */
+    template<typename T, typename = typename std::enable_if<std::is_arithmetic<T>::value>::type>
+    ElementSpec& property(const std::string& property_name, const T value, const bool optional = false)
+    {
+        return property(property_name, std::to_string(value), optional);
+    }
+    /**
+    @brief sets the caps used when linking to the next element
+    @param element_caps caps string
+    @returns the spec, for chaining
+    */
+    ElementSpec& linkCaps(const std::string& element_caps)
+    {
+        caps = element_caps;
+        return *this;
+    }
+};
+
+
+
+
+/**
+@brief declarative description of a pipeline. GStreamPipeline::build validates the whole spec,
+factories, properties, caps and links, before anything is added to the pipeline
+*/
+class PipelineSpec
+{
+public:
+    std::deque<ElementSpec>               elements;   // deque so references returned by add stay valid
+    std::vector<std::vector<std::string>> chains;     // elements linked in order. Names may also refer to elements already in the pipeline
+
+    PipelineSpec()
+        : elements(), chains()
+    {}
+    /**
+    @brief adds an element
+    @param factory plugin feature name
+    @param name element name
+    @returns the element spec, valid for the lifetime of the spec
+    */
+    ElementSpec& add(const std::string& factory, const std::string& name)
+    {
+        elements.emplace_back(factory, name);
+        return elements.back();
+    }
+    /**
+    @brief links elements in order
+    @param chain element names
+    */
+    void link(const std::vector<std::string>& chain)
+    {
+        if(chain.size() > 1)
+            chains.push_back(chain);
+    }
+    /**
+    @param name element name
+    @returns the element spec, NULL if there is none with that name
+    */
+    ElementSpec* find(const std::string& name)
+    {
+        for(ElementSpec& element : elements)
+        {
+            if(element.name == name)
+                return &element;
+        }
+        return NULL;
+    }
+};
+
+
+#endif // PIPELINE_SPEC_H
@@ -0,0 +1,263 @@
+#ifndef PRE_EVENT_BUFFER_H
+#define PRE_EVENT_BUFFER_H
+
+#include <gst/gst.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "EncodedFrame.h"
+
+
+
+
+/**
+@brief counters kept by a PreEventBuffer
+*/
+struct PreEventStats
+{
+    gsize   bytes;          // bytes of compressed video held
+    size_t  frames;         // access units held
+    size_t  keyframes;      // keyframes held, each one is a point a dump can start from
+    guint64 evicted;        // access units dropped to stay inside the byte and duration bounds
+    guint64 dumps;          // dumps taken
+};
+
+
+
+
+/**
+@brief ring of the most recent compressed access units of a stream, for recording what happened before an event.
+Access units are kept as EncodedFramePtrs, so nothing is copied, and indexed by keyframe. The ring is bounded by bytes
+and by duration, the oldest GOP goes first and the ring always starts at a keyframe. A dump starts at the keyframe at or
+before the requested point, so it decodes on its own. Feed it from the parser output, see StreamConfig::pre_event
+*/
+class PreEventBuffer
+{
+private:
+    struct Entry
+    {
+        EncodedFramePtr frame;
+        GstClockTime    pts;
+    };
+
+    const gsize             m_max_bytes;
+    const GstClockTime      m_max_duration;
+
+    mutable std::mutex      m_mutex;
+    std::deque<Entry>       m_entries;
+    guint64                 m_first;        // sequence number of m_entries.front()
+    std::deque<guint64>     m_keyframes;    // sequence numbers of the keyframes held, oldest first
+    gsize                   m_bytes;
+    guint64                 m_evicted;
+    mutable guint64         m_dumps;
+
+    /**
+    @brief drops the oldest access unit. m_mutex must be held
+    */
+    void evictFront()
+    {
+        m_bytes -= m_entries.front().frame->size();
+        m_entries.pop_front();
+        if(!m_keyframes.empty() && m_keyframes.front() == m_first)
+            m_keyframes.pop_front();
+        m_first++;
+        m_evicted++;
+    }
+    /**
+    @returns true if the ring holds more than its bounds allow. m_mutex must be held
+    */
+    bool overBounds() const
+    {
+        if(m_bytes > m_max_bytes)
+            return true;
+        const GstClockTime oldest = m_entries.front().pts;
+        const GstClockTime newest = m_entries.back().pts;
+        return GST_CLOCK_TIME_IS_VALID(oldest) && GST_CLOCK_TIME_IS_VALID(newest) && newest > oldest && newest - oldest > m_max_duration;
+    }
+    /**
+    @brief collects the access units from the keyframe at or before the newest pts minus duration. m_mutex must be held
+    @param duration how far back the dump reaches
+    @param frames receives the access units, oldest first
+    */
+    void collect(const GstClockTime duration, std::vector<EncodedFramePtr>& frames) const
+    {
+        frames.clear();
+        if(m_keyframes.empty())
+            return;
+
+        // the newest keyframe whose pts is not after the start. Keyframes without a pts never start a dump
+        const GstClockTime newest = m_entries.back().pts;
+        const bool bounded = GST_CLOCK_TIME_IS_VALID(newest) && GST_CLOCK_TIME_IS_VALID(duration);
+        const GstClockTime start = bounded && newest > duration ? newest - duration : 0;
+        guint64 first = m_keyframes.front();
+        if(bounded)
+        {
+            for(const guint64 keyframe : m_keyframes)
+            {
+                const GstClockTime pts = m_entries[keyframe - m_first].pts;
+                if(!GST_CLOCK_TIME_IS_VALID(pts) || pts > start)
+                    break;
+                first = keyframe;
+            }
+        }
+
+        frames.reserve(m_first + m_entries.size() - first);
+        for(auto it = m_entries.begin() + (first - m_first); it != m_entries.end(); ++it)
+            frames.push_back(it->frame);
+        m_dumps++;
+    }
+
+public:
+    /**
+    @param max_bytes most bytes of compressed video held
+    @param max_duration longest span of pts held
+    */
+    PreEventBuffer(const gsize max_bytes, const GstClockTime max_duration)
+        : m_max_bytes(max_bytes), m_max_duration(max_duration), m_mutex(), m_entries(), m_first(0), m_keyframes(),
+          m_bytes(0), m_evicted(0), m_dumps(0)
+    {}
+
+    PreEventBuffer(PreEventBuffer&&) = delete;
+    PreEventBuffer(const PreEventBuffer&) = delete;
+    /**
+    @brief appends an access unit and drops the oldest ones past the bounds. Delta units before the first keyframe are dropped,
+    nothing could decode them
+    @param frame access unit from the parser
+    */
+    void push(const EncodedFramePtr& frame)
+    {
+        const bool keyframe = frame->isKeyframe();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_entries.empty() && !keyframe)
+        {
+            m_evicted++;
+            return;
+        }
+
+        if(keyframe)
+            m_keyframes.push_back(m_first + m_entries.size());
+        m_entries.push_back({frame, frame->pts()});
+        m_bytes += frame->size();
+
+        // whole GOPs go at once, the ring must keep starting at a keyframe
+        while(m_entries.size() > 1 && overBounds())
+        {
+            if(m_keyframes.size() < 2)
+            {
+                // a single GOP larger than the bounds. Keep it until the next keyframe starts a new one
+                break;
+            }
+            const guint64 next = m_keyframes[1];
+            while(m_first < next)
+                evictFront();
+        }
+    }
+    /**
+    @returns callback to hand access units to the ring, EG from an encoded appsink. It holds a pointer to the ring, which must outlive the stream
+    */
+    encoded_callback input()
+    {
+        return [this](const EncodedFramePtr& frame){ push(frame); };
+    }
+    /**
+    @brief copies out the access units from the keyframe at or before the newest pts minus duration. The units stay in the ring
+    @param duration how far back to reach. GST_CLOCK_TIME_NONE returns everything held
+    @param frames receives the access units, oldest first. Empty if the ring holds no keyframe
+    */
+    void snapshot(const GstClockTime duration, std::vector<EncodedFramePtr>& frames) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        collect(duration, frames);
+    }
+    /**
+    @brief hands the access units of a snapshot to a callback, outside the lock so the stream keeps filling the ring
+    @param duration See snapshot
+    @param callback called once per access unit, oldest first
+    @returns number of access units delivered
+    */
+    size_t dump(const GstClockTime duration, const encoded_callback& callback) const
+    {
+        std::vector<EncodedFramePtr> frames;
+        snapshot(duration, frames);
+        for(const EncodedFramePtr& frame : frames)
+            callback(frame);
+        return frames.size();
+    }
+    /**
+    @brief writes the access units of a snapshot to a file as the raw parser output. For h264 and h265 that is an annex b byte-stream
+    @param duration See snapshot
+    @param path file to write, replaced if it exists
+    @returns false if nothing was held or the file could not be written
+    */
+    bool dumpToFile(const GstClockTime duration, const std::string& path) const
+    {
+        std::vector<EncodedFramePtr> frames;
+        snapshot(duration, frames);
+        if(frames.empty())
+            return false;
+
+        FILE* file = std::fopen(path.c_str(), "wb");
+        if(file == NULL)
+        {
+            std::cout << "Failed to open " << path << " for the pre-event dump\n";
+            return false;
+        }
+        bool written = true;
+        for(const EncodedFramePtr& frame : frames)
+            written = written && std::fwrite(frame->data(), 1, frame->size(), file) == frame->size();
+        written = std::fclose(file) == 0 && written;
+        if(!written)
+            std::cout << "Failed to write the pre-event dump to " << path << '\n';
+        return written;
+    }
+    /**
+    @brief drops everything held, EG after the stream reconnected to a camera with other parameter sets
+    */
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_first += m_entries.size();
+        m_entries.clear();
+        m_keyframes.clear();
+        m_bytes = 0;
+    }
+    /**
+    @returns a snapshot of the ring counters
+    */
+    PreEventStats stats() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        PreEventStats stats;
+        stats.bytes = m_bytes;
+        stats.frames = m_entries.size();
+        stats.keyframes = m_keyframes.size();
+        stats.evicted = m_evicted;
+        stats.dumps = m_dumps;
+        return stats;
+    }
+    /**
+    @returns pts span between the oldest and newest access unit held, 0 if unknown
+    */
+    GstClockTime span() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_entries.empty())
+            return 0;
+        const GstClockTime oldest = m_entries.front().pts;
+        const GstClockTime newest = m_entries.back().pts;
+        return GST_CLOCK_TIME_IS_VALID(oldest) && GST_CLOCK_TIME_IS_VALID(newest) && newest > oldest ? newest - oldest : 0;
+    }
+};
+
+
+typedef std::shared_ptr<PreEventBuffer> PreEventBufferPtr;
+
+
+#endif // PRE_EVENT_BUFFER_H
@@ -0,0 +1,163 @@
+#ifndef RESOURCE_USAGE_H
+#define RESOURCE_USAGE_H
+
+#include <gst/gst.h>
+
+#include <pthread.h>
+#include <time.h>
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+
+
+
+/**
+@brief memory and cpu time accounted to one stream
+*/
+struct ResourceUsage
+{
+    gsize        jitterbuffer_bytes;    // rtp packets held by the jitterbuffers of the session
+    gsize        queue_bytes;           // buffers held by the queues of the pipeline
+    gsize        pool_bytes;            // frames preallocated by the appsink buffer pools
+    gsize        ring_bytes;            // decoded frames waiting in the frame ring
+    gsize        pre_event_bytes;       // compressed video held by the pre-event buffer
+    GstClockTime cpu_time;              // cpu time of the streaming threads, summed over the life of the stream
+
+    ResourceUsage()
+        : jitterbuffer_bytes(0), queue_bytes(0), pool_bytes(0), ring_bytes(0), pre_event_bytes(0), cpu_time(0)
+    {}
+    /**
+    @returns every byte accounted
+    */
+    gsize memory() const
+    {
+        return jitterbuffer_bytes + queue_bytes + pool_bytes + ring_bytes + pre_event_bytes;
+    }
+};
+
+
+/**
+@brief how far a stream is held back to bring the process under its memory budget. Every level includes the ones before it
+*/
+enum class StreamThrottle
+{
+    NONE,       // runs as configured
+    QUEUES,     // the jitterbuffers drop packets past a short latency and the unbounded queues hold less
+    DECIMATE,   // only keyframes are decoded
+    PAUSE       // the stream is in standby, see RtspStream::standby
+};
+
+
+/**
+@param throttle throttle level
+@returns the level name used in logs and metrics
+*/
+inline const char* throttleName(const StreamThrottle throttle)
+{
+    switch(throttle)
+    {
+        case StreamThrottle::QUEUES:
+            return "queues";
+        case StreamThrottle::DECIMATE:
+            return "decimate";
+        case StreamThrottle::PAUSE:
+            return "pause";
+        default:
+            return "none";
+    }
+}
+
+
+
+
+/**
+@brief sums the cpu time of the streaming threads of one pipeline. Feed it every STREAM_STATUS message from a bus sync handler,
+ENTER and LEAVE are posted by the streaming thread itself so its cpu clock can be read there. Threads are pooled by gstreamer
+and can serve several pipelines, only the time between ENTER and LEAVE is accounted
+*/
+class ThreadCpuClock
+{
+private:
+    struct Thread
+    {
+        pthread_t    thread;
+        clockid_t    clock;
+        GstClockTime entered;   // cpu time of the thread at ENTER
+    };
+
+    mutable std::mutex  m_mutex;
+    std::vector<Thread> m_threads;  // threads currently streaming
+    GstClockTime        m_left;     // cpu time of the threads that left
+
+    /**
+    @param clock cpu clock of a thread
+    @returns the cpu time of the thread, 0 if the clock can't be read
+    */
+    static GstClockTime cpuTime(const clockid_t clock)
+    {
+        struct timespec now;
+        return clock_gettime(clock, &now) == 0 ? GST_TIMESPEC_TO_TIME(now) : 0;
+    }
+
+public:
+    ThreadCpuClock()
+        : m_mutex(), m_threads(), m_left(0)
+    {}
+
+    ThreadCpuClock(ThreadCpuClock&&) = delete;
+    ThreadCpuClock(const ThreadCpuClock&) = delete;
+    /**
+    @brief starts or stops accounting the calling thread. Must be called from the thread that posted the message
+    @param message any message, only STREAM_STATUS ENTER and LEAVE are used
+    */
+    void onMessage(GstMessage* message)
+    {
+        if(GST_MESSAGE_TYPE(message) != GST_MESSAGE_STREAM_STATUS)
+            return;
+        GstStreamStatusType type;
+        GstElement* owner = NULL;
+        gst_message_parse_stream_status(message, &type, &owner);
+        if(type != GST_STREAM_STATUS_TYPE_ENTER && type != GST_STREAM_STATUS_TYPE_LEAVE)
+            return;
+
+        const pthread_t self = pthread_self();
+        clockid_t clock;
+        if(pthread_getcpuclockid(self, &clock) != 0)
+            return;
+        const GstClockTime now = cpuTime(clock);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = std::find_if(m_threads.begin(), m_threads.end(), [self](const Thread& thread){ return pthread_equal(thread.thread, self) != 0; });
+        if(type == GST_STREAM_STATUS_TYPE_ENTER)
+        {
+            if(found == m_threads.end())
+                m_threads.push_back({self, clock, now});
+            return;
+        }
+        if(found != m_threads.end())
+        {
+            // removed under the lock before the thread can exit, so total never reads the clock of a dead thread
+            m_left += now > found->entered ? now - found->entered : 0;
+            m_threads.erase(found);
+        }
+    }
+    /**
+    @returns cpu time of every thread accounted so far, including the time of the threads still streaming
+    */
+    GstClockTime total() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        GstClockTime total = m_left;
+        for(const Thread& thread : m_threads)
+        {
+            const GstClockTime now = cpuTime(thread.clock);
+            total += now > thread.entered ? now - thread.entered : 0;
+        }
+        return total;
+    }
+};
+
+
+#endif // RESOURCE_USAGE_H
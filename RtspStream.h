@@ -0,0 +1,2580 @@
+#ifndef RTSP_STREAM_H
+#define RTSP_STREAM_H
+
+#include <gst/gst.h>
+#include <gst/rtsp/gstrtsptransport.h>
+#include <gst/video/video.h>
+
+#include <string>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "AudioCodec.h"
+#include "EncodedFrame.h"
+#include "FactoryCache.h"
+#include "FrameDecimator.h"
+#include "FrameRing.h"
+#include "GStreamPipeline.h"
+#include "Instrumentation.h"
+#include "LatencyProfile.h"
+#include "PipelineSpec.h"
+#include "PreEventBuffer.h"
+#include "ResourceUsage.h"
+#include "SharedFrameRing.h"
+#include "StreamEvents.h"
+#include "VideoCodec.h"
+#include "VideoFrame.h"
+
+
+
+
+/**
+@brief lower transport of the rtsp session, ordered from least to most reliable. Falling back moves one step down the list
+*/
+enum class RtspTransport
+{
+    UDP_MULTICAST,  // one multicast group shared by every client of the camera
+    UDP,            // unicast rtp over udp
+    TCP             // rtp interleaved on the rtsp connection. Never loses packets, but a loss stalls the stream instead
+};
+
+
+/**
+@param transport transport
+@returns the transport name used in logs and metrics
+*/
+inline const char* transportName(const RtspTransport transport)
+{
+    switch(transport)
+    {
+        case RtspTransport::UDP_MULTICAST:
+            return "udp-multicast";
+        case RtspTransport::UDP:
+            return "udp";
+        case RtspTransport::TCP:
+            return "tcp";
+    }
+    return "unknown";
+}
+
+
+/**
+@brief packet counters of a stream, accumulated over every session
+*/
+struct TransportStats
+{
+    RtspTransport transport;    // transport of the current session
+    guint64       packets;      // rtp packets pushed out of the jitterbuffer
+    guint64       lost;         // rtp packets the jitterbuffer gave up on
+    guint64       late;         // rtp packets that arrived after their slot was played out
+    guint64       switches;     // transport fallbacks so far
+    double        loss_ratio;   // lost / expected over the last measurement window
+};
+
+
+typedef std::function<void(RtspTransport from, RtspTransport to, double loss_ratio)> transport_callback;
+typedef std::function<void(bool established)> setup_callback;
+typedef std::function<bool()> admission_callback;
+
+
+/**
+@brief container of recorded segments
+*/
+enum class RecordFormat
+{
+    AUTO,           // the codec muxer, mp4 or matroska for mjpeg. A location without a % format writes the raw parser output instead
+    MP4,            // a single file is only finalized by an EOS, use FRAGMENTED_MP4 without a % format
+    FRAGMENTED_MP4, // moof fragments, every fragment is playable before the segment is closed
+    MPEG_TS,        // h264 and h265 only
+    MATROSKA
+};
+
+
+/**
+@brief a recorded segment splitmuxsink closed
+*/
+struct RecordedSegment
+{
+    std::string  location;      // file the segment was written to
+    GstClockTime start;         // running time of the first frame
+    GstClockTime duration;      // running time from the first frame to the close, GST_CLOCK_TIME_NONE if the open wasn't seen
+};
+
+
+typedef std::function<void(const RecordedSegment& segment)> segment_callback;
+
+
+
+
+/**
+@brief decoded output of a stream, See RtspStream::reconfigure
+*/
+struct OutputFormat
+{
+    std::string format;     // pixel format. Empty keeps whatever the decoder produces
+    gint        width;      // 0 keeps the decoded width
+    gint        height;     // 0 keeps the decoded height
+    gint        fps_n;      // 0 keeps the stream framerate
+    gint        fps_d;
+};
+
+
+
+
+/**
+@brief an extra output of the decoded video, EG a thumbnail or a region of interest. It branches off after the decoder,
+so it shares the rtsp session and the decode with the main output
+*/
+struct OutputBranch
+{
+    std::string    name;            // used in logs
+    frame_callback on_frame;        // receives the frames of the branch on its own streaming thread
+    gint           crop_left;       // pixels cut from each edge of the decoded frame before scaling
+    gint           crop_top;
+    gint           crop_right;
+    gint           crop_bottom;
+    OutputFormat   output;          // scaled output, zero and empty fields keep the cropped frame
+
+    OutputBranch()
+        : name(), on_frame(), crop_left(0), crop_top(0), crop_right(0), crop_bottom(0), output{std::string(), 0, 0, 0, 1}
+    {}
+};
+
+
+
+
+/**
+@brief settings used to build a single camera pipeline
+*/
+struct StreamConfig
+{
+    std::string    location;    // rtsp location of the stream
+    frame_callback on_frame;    // when set the stream terminates in an appsink and frames are delivered here
+    FrameRingPtr   frame_ring;  // when set the stream terminates in an appsink and samples are queued here. Takes precedence over on_frame
+    VideoCodec     codec;       // video codec. AUTO reads it from the video pad rtspsrc adds and builds the rest of the stream then
+    std::string    decoder;     // decoder plugin to use. Empty picks the best one available for the codec
+    bool           instrument;  // install pad probes on every element, see GStreamPipeline::enableInstrumentation
+    std::string    format;      // output pixel format. Empty keeps whatever the decoder produces
+    gint           width;       // output width, 0 keeps the decoded width
+    gint           height;      // output height, 0 keeps the decoded height
+    gint           fps_n;       // output framerate numerator, 0 keeps the stream framerate
+    gint           fps_d;       // output framerate denominator
+    std::vector<OutputBranch> outputs; // more outputs fanned out through a tee after the decoder, each to its own appsink. System memory only
+    bool           reconfigurable; // always build videoscale, videorate and videoconvert, so RtspStream::reconfigure can change the output while playing
+    bool           decode;      // decode the video. false stops after the parser and only feeds the compressed outputs
+    bool           lazy_decode; // only attach the decode branch while a consumer is subscribed, see RtspStream::subscribeDecode
+    double         target_fps;  // drop frames before the decoder down to this rate, 0 decodes every frame
+    bool           keyframes_only; // only decode keyframes
+    bool           frame_pool;  // hand the converter a pool of preallocated buffers when frames go to an appsink
+    std::string    shm_name;    // when set decoded frames are published to this POSIX shared memory ring, see SharedFrameRing.h. Ignored with frame_ring
+    guint          shm_slots;   // frames kept in the shared memory ring
+    bool           gpu_memory;  // keep decoded frames in CUDA memory, nvdec -> cudascale/cudaconvert -> appsink. See VideoFrame::isDevice
+
+    AudioMode        audio;             // DROP never sets up the audio track, so the camera doesn't send it
+    encoded_callback on_audio;          // audio buffers are delivered here, the caps say whether they are compressed or S16LE. Without it audio is dropped
+
+    encoded_callback on_access_unit;    // when set compressed frames from the parser are delivered here
+    PreEventBufferPtr pre_event;        // when set the compressed frames from the parser are also kept here, for dumps of what happened before an event
+    std::string      record_location;   // when set the elementary stream is recorded here. A % format writes segments, EG /rec/cam1-%05d.mp4
+    guint64          segment_duration;  // segment length in nanoseconds when recording segments. Segments are cut at the next keyframe
+    RecordFormat     record_format;     // container of the recording
+    guint            fragment_ms;       // fragment length with FRAGMENTED_MP4
+    bool             keyframe_requests; // ask the camera for a keyframe at every split, so segments come out at segment_duration
+    guint            write_buffer;      // bytes filesink gathers before each write, 0 keeps the stdio default
+    segment_callback on_segment;        // called on the stream context thread after every segment is closed
+
+    bool           reconnect;           // rebuild the rtsp session when the camera drops or the connection fails
+    guint          reconnect_min_ms;    // shortest delay before a reconnect attempt
+    guint          reconnect_max_ms;    // longest delay before a reconnect attempt. The delay doubles per failed attempt up to this
+
+    RtspTransport      transport;           // transport of the first session
+    bool               transport_fallback;  // move to a more reliable transport on packet loss or when sessions keep failing
+    double             loss_threshold;      // loss ratio over one window that triggers a fallback
+    guint              loss_interval_ms;    // length of the loss measurement window
+    transport_callback on_transport_switch; // called on the stream context thread after every fallback
+
+    LatencySettings latency;            // jitterbuffer, decoder and sink tuning. Start from latencySettings(profile)
+    bool            measure_latency;    // measure glass to glass latency at the sink, see RtspStream::glassToGlass
+    bool            wallclock;          // stamp decoded frames with their capture time on the camera, see VideoFrame::captureTime.
+                                        // Turns on ntp-sync and a realtime pipeline clock, camera and host must both be synced to NTP
+
+    EventQueuePtr  events;          // when set errors, warnings, qos, eos, stream-start, latency and buffering messages are queued here
+
+    bool           stage_queues;    // put a queue after the depayloader, the decoder and the conversions so each stage runs on its own thread
+    guint          convert_threads; // threads videoscale and videoconvert split each frame across, 0 uses one per core
+    gint           priority;        // streams with a lower priority are throttled first when the StreamManager memory budget is exceeded
+
+    StreamConfig()
+        : location(), on_frame(), frame_ring(), codec(VideoCodec::AUTO), decoder(), instrument(false),
+          format("I420"), width(0), height(0), fps_n(0), fps_d(1), outputs(), reconfigurable(false), decode(true), lazy_decode(false), target_fps(0.0), keyframes_only(false), frame_pool(true), shm_name(), shm_slots(4), gpu_memory(false),
+          audio(AudioMode::DROP), on_audio(),
+          on_access_unit(), pre_event(), record_location(), segment_duration(60 * GST_SECOND),
+          record_format(RecordFormat::AUTO), fragment_ms(1000), keyframe_requests(false), write_buffer(0), on_segment(),
+          reconnect(true), reconnect_min_ms(250), reconnect_max_ms(30000),
+          transport(RtspTransport::UDP), transport_fallback(true), loss_threshold(0.02), loss_interval_ms(2000), on_transport_switch(),
+          latency(latencySettings(LatencyProfile::LOW_LATENCY)), measure_latency(false), wallclock(false),
+          events(), stage_queues(false), convert_threads(1), priority(0)
+    {}
+};
+
+
+
+
+/**
+@brief a single rtspsrc pipeline built from a StreamConfig.
+rtspsrc feeds the depayloader and parser of the stream codec. After the parser the stream is decoded, delivered as compressed access units, recorded, or any combination fanned out through a tee
+*/
+class RtspStream
+{
+private:
+    std::string     m_name;
+    StreamConfig    m_config;
+    ThreadCpuClock  m_cpu;      // fed by the bus sync handler
+    GStreamPipeline m_pipeline;
+    std::string     m_decoder;
+    bool            m_device;   // decoded frames stay in CUDA memory
+    mutable std::mutex m_output_mutex;
+    OutputFormat    m_output;   // output the decode branch negotiates
+    FrameDecimator  m_decimator;
+
+    /**
+    @brief an rtspsrc pad blocked until the chain it feeds is built on the stream context
+    */
+    struct PendingPad
+    {
+        GstPad*  pad;
+        gulong   probe;
+        GSource* source;    // idle source building the chain
+    };
+
+    // everything after rtspsrc is built for one codec. With VideoCodec::AUTO that happens on the stream context once the video pad appears
+    std::atomic<VideoCodec> m_codec;
+    std::atomic<bool> m_chain_built;
+    PendingPad      m_pending_video;
+
+    // the audio chain is always built once its pad appears, the codec is only known from the SDP
+    std::atomic<AudioCodec> m_audio_codec;
+    std::atomic<bool> m_audio_built;
+    PendingPad      m_pending_audio;
+
+    std::mutex               m_decode_mutex;
+    size_t                   m_decode_subscribers;
+    std::vector<std::string> m_decode_chain;    // decode branch from its queue to the sink
+    std::vector<std::vector<std::string>> m_output_chains;  // OutputBranches, each from the decoded tee to its sink
+    GstPad*                  m_decode_tee_pad;  // tee pad feeding the decode branch, NULL while detached
+    std::atomic<gulong>      m_keyframe_probe;  // dropUntilKeyframe probe on the decode branch, 0 once it saw a keyframe
+
+    // reconnect state, only touched from the thread running m_context
+    GMainContext*        m_context;
+    GSource*             m_reconnect_source;    // pending reconnect timer, NULL when none is scheduled
+    guint                m_reconnect_attempts;  // attempts since data last flowed
+    bool                 m_reconnect_queued;    // waiting for a setup slot from the admission callback, only touched from m_context
+    std::atomic<bool>    m_running;             // between start and stop, a stopped stream never reconnects
+    std::atomic<bool>    m_receiving;           // data reached the parser since the last reconnect
+    std::atomic<guint64> m_reconnects;
+
+    // transport state, the session counters are only touched from the thread running m_context
+    std::atomic<RtspTransport> m_transport;
+    GSource*             m_loss_source;         // periodic loss measurement
+    guint64              m_session_packets;     // jitterbuffer counters of the current session at the last measurement
+    guint64              m_session_lost;
+    guint64              m_session_late;
+    std::atomic<guint64> m_packets;
+    std::atomic<guint64> m_lost;
+    std::atomic<guint64> m_late;
+    std::atomic<guint64> m_transport_switches;
+    std::atomic<double>  m_loss_ratio;
+
+    LatencyHistogram     m_glass_to_glass;
+
+    setup_callback       m_on_setup;
+    admission_callback   m_on_admission;
+    std::atomic<bool>    m_setup_pending;       // start or an admitted reconnect set up a session that has neither delivered data nor failed yet
+
+    // startup timing, microseconds since the last start or resume. -1 until reached
+    std::atomic<gint64>  m_start_us;
+    std::atomic<gint64>  m_time_to_playing_us;
+    std::atomic<gint64>  m_time_to_first_frame_us;
+    std::atomic<bool>    m_standby;
+
+    std::unique_ptr<SharedFrameWriter> m_shared;    // shared memory export, only written from the videosink streaming thread
+
+    EventQueuePtr        m_events;
+    LogLimiter           m_log;                 // everything logged after the build goes through here
+
+    GstClockTime         m_segment_start;       // running time the open recording segment started at, only touched from m_context
+
+    // memory budget throttling, see throttle
+    mutable std::mutex   m_throttle_mutex;
+    StreamThrottle       m_throttle;
+    double               m_target_fps;          // decimation set through the config or setDecimation, restored when the throttle is lifted
+    bool                 m_keyframes_only;
+    bool                 m_throttle_paused;     // the throttle put the stream in standby
+
+    /**
+    @brief jitterbuffer counters summed over the elements inside rtspsrc
+    */
+    struct JitterbufferTotals
+    {
+        guint64 packets;
+        guint64 lost;
+        guint64 late;
+    };
+    /**
+    @brief fill of one jitterbuffer, kept as object data on the jitterbuffer so it goes away with it. The jitterbuffer holds
+    the packets between the newest one pushed and the newest one received, so the fill doesn't drift when packets are dropped inside
+    */
+    struct JitterbufferLevel
+    {
+        std::atomic<gint>  received;    // seqnum of the newest packet received, -1 before the first
+        std::atomic<gint>  pushed;      // seqnum of the newest packet pushed, -1 before the first
+        std::atomic<guint> waiting;     // packets received before the first push
+        std::atomic<guint> packet_size; // running mean of the packet size
+
+        JitterbufferLevel()
+            : received(-1), pushed(-1), waiting(0), packet_size(0)
+        {}
+        /**
+        @returns estimated bytes held
+        */
+        gsize bytes() const
+        {
+            const gint newest = received.load(std::memory_order_relaxed);
+            const gint last = pushed.load(std::memory_order_relaxed);
+            if(newest < 0)
+                return 0;
+            guint held = last < 0 ? waiting.load(std::memory_order_relaxed) : static_cast<guint>(newest - last) & 0xffff;
+            if(held > 0x8000)
+                held = 0;   // the push overtook the seqnum read of the receive
+            return static_cast<gsize>(held) * packet_size.load(std::memory_order_relaxed);
+        }
+    };
+    /**
+    @brief memory held by the elements of the pipeline, see addElementUsage
+    */
+    struct ElementUsage
+    {
+        gsize jitterbuffers;
+        gsize queues;
+    };
+    /**
+    @brief jitterbuffer and queue limits applied by the QUEUES throttle, see applyQueueLimits
+    */
+    struct QueueLimits
+    {
+        guint    latency_ms;        // rtpjitterbuffer latency
+        gboolean drop_on_latency;   // rtpjitterbuffer drop-on-latency
+        guint    max_bytes;         // max-size-bytes of the queues that don't leak
+        guint64  max_time;          // max-size-time of the queues that don't leak
+    };
+
+    /**
+    @brief handshake between unsubscribeDecode and the idle probe unlinking the decode branch
+    */
+    struct DetachWait
+    {
+        std::mutex              mutex;
+        std::condition_variable condition;
+        bool                    unlinked;
+    };
+
+    /**
+    @returns the elements of the stream codec. Only valid once the codec is known
+    */
+    const CodecElements& elements() const
+    {
+        return codecElements(m_codec.load());
+    }
+    /**
+    @brief picks the decoder from the config override or the registry. An override for a detected codec is only used if it decodes that codec
+    @returns decoder plugin name, empty if none is available
+    */
+    std::string selectDecoder() const
+    {
+        const std::vector<std::string>& decoders = elements().decoders;
+        if(!m_config.decoder.empty())
+        {
+            const bool matches = m_config.codec != VideoCodec::AUTO || std::find(decoders.begin(), decoders.end(), m_config.decoder) != decoders.end();
+            if(matches && !GStreamPipeline::findAvailableFactory({m_config.decoder}).empty())
+                return m_config.decoder;
+            std::cout << m_name << ": decoder " << m_config.decoder << " is not available for " << elements().name << ", selecting automatically\n";
+        }
+        return GStreamPipeline::findAvailableFactory(decoders);
+    }
+    /**
+    @brief checks that everything a device memory decode branch needs is installed. The cuda converters ship with the nvcodec plugin from gstreamer 1.22
+    @returns true if frames can stay in CUDA memory from the decoder to the appsink
+    */
+    bool gpuPathAvailable() const
+    {
+        for(const char* factory : {elements().cuda_decoder, "cudaupload", "cudascale", "cudaconvert"})
+        {
+            if(FactoryCache::instance().find(factory) == NULL)
+            {
+                std::cout << m_name << ": " << factory << " is not available, decoding to system memory\n";
+                return false;
+            }
+        }
+        return true;
+    }
+    /**
+    @brief checks whether every raw format an element can output is already the requested one, in which case
+    there is nothing for videoconvert to do. Reads the factory pad templates, so no element has to exist yet
+    @param factory_name element factory
+    @param format requested pixel format
+    @returns See above
+    */
+    static bool factoryOnlyOutputs(const std::string& factory_name, const std::string& format)
+    {
+        GstElementFactory* factory = FactoryCache::instance().find(factory_name);
+        if(factory == NULL)
+            return false;
+
+        GstCaps* wanted = gst_caps_from_string(("video/x-raw, format=(string)" + format).c_str());
+        bool only = false;
+        for(const GList* item = gst_element_factory_get_static_pad_templates(factory); item != NULL; item = item->next)
+        {
+            GstStaticPadTemplate* pad_template = static_cast<GstStaticPadTemplate*>(item->data);
+            if(pad_template->direction != GST_PAD_SRC)
+                continue;
+
+            GstCaps* produced = gst_static_pad_template_get_caps(pad_template);
+            only = produced != NULL && wanted != NULL && gst_caps_is_subset(produced, wanted);
+            if(produced != NULL)
+                gst_caps_unref(produced);
+            break;
+        }
+
+        if(wanted != NULL)
+            gst_caps_unref(wanted);
+        return only;
+    }
+    /**
+    @param output requested output
+    @param device true if the frames stay in CUDA memory
+    @returns caps string describing the requested output, empty when nothing is requested in system memory
+    */
+    static std::string outputCaps(const OutputFormat& output, const bool device)
+    {
+        std::string caps;
+        if(!output.format.empty())
+            caps += ", format=(string)" + output.format;
+        if(output.width > 0)
+            caps += ", width=(int)" + std::to_string(output.width);
+        if(output.height > 0)
+            caps += ", height=(int)" + std::to_string(output.height);
+        if(output.fps_n > 0)
+            caps += ", framerate=(fraction)" + std::to_string(output.fps_n) + "/" + std::to_string(std::max(output.fps_d, 1));
+        if(device)
+            return "video/x-raw(" GST_CAPS_FEATURE_MEMORY_CUDA_MEMORY ")" + caps;
+        return caps.empty() ? caps : "video/x-raw" + caps;
+    }
+    /**
+    @brief sets the caps of an output on the capsfilter of a reconfigurable decode branch. m_output_mutex must be held
+    @param output output to apply
+    @returns false if the caps are invalid
+    */
+    bool applyOutput(const OutputFormat& output)
+    {
+        const std::string caps_string = outputCaps(output, m_device);
+        GstCaps* caps = gst_caps_from_string(caps_string.empty() ? "video/x-raw" : caps_string.c_str());
+        if(caps == NULL)
+        {
+            std::cout << m_name << ": invalid output " << caps_string << '\n';
+            return false;
+        }
+        m_pipeline.setElementProperty("outputcaps", "caps", caps);
+        gst_caps_unref(caps);
+        return true;
+    }
+    /**
+    @brief idle probe on the tee pad feeding the decode branch. Unlinks the branch between two buffers
+    @param pad tee src pad
+    @param info probe info
+    @param user_data DetachWait to signal
+    @returns GST_PAD_PROBE_REMOVE
+    */
+    static GstPadProbeReturn onDecodePadIdle(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+    {
+        DetachWait* wait = static_cast<DetachWait*>(user_data);
+
+        GstPad* peer = gst_pad_get_peer(pad);
+        if(peer != NULL)
+        {
+            gst_pad_unlink(pad, peer);
+            gst_object_unref(peer);
+        }
+
+        std::lock_guard<std::mutex> lock(wait->mutex);
+        wait->unlinked = true;
+        wait->condition.notify_one();
+        return GST_PAD_PROBE_REMOVE;
+    }
+    /**
+    @brief drops delta frames entering a freshly attached decode branch, so decoding starts on a keyframe
+    @param pad decode queue sink pad
+    @param info probe info
+    @param user_data RtspStream
+    @returns GST_PAD_PROBE_DROP until the first keyframe, then GST_PAD_PROBE_REMOVE
+    */
+    static GstPadProbeReturn dropUntilKeyframe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+    {
+        GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        if(GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+            return GST_PAD_PROBE_DROP;
+        static_cast<RtspStream*>(user_data)->m_keyframe_probe.store(0);
+        return GST_PAD_PROBE_REMOVE;
+    }
+    /**
+    @brief puts the decode branch back into the pipeline, links it to the tee and asks the camera for a keyframe.
+    m_decode_mutex must be held
+    @returns true on success false on failure
+    */
+    bool attachDecodeBranch()
+    {
+        if(!m_pipeline.restoreElements(decodeElements()) || !m_pipeline.linkElementsByName(m_decode_chain))
+            return false;
+        for(const std::vector<std::string>& output : m_output_chains)
+        {
+            if(!m_pipeline.linkElementsByName(output))
+                return false;
+        }
+
+        // downstream first, so nothing is pushed into an element that isn't running yet
+        const std::vector<std::string> elements = decodeElements();
+        for(auto name = elements.rbegin(); name != elements.rend(); name++)
+            gst_element_sync_state_with_parent(m_pipeline.getElementByName(*name));
+
+        GstElement* tee = m_pipeline.getElementByName("videotee");
+        GstPad* sink_pad = gst_element_get_static_pad(m_pipeline.getElementByName(m_decode_chain.front()), "sink");
+        // a detach before the keyframe arrived removes the probe, so it is never installed twice
+        if(m_keyframe_probe.load() == 0)
+            m_keyframe_probe.store(gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, dropUntilKeyframe, this, NULL));
+
+        m_decode_tee_pad = gst_element_get_request_pad(tee, "src_%u");
+        const bool linked = m_decode_tee_pad != NULL && GST_PAD_LINK_SUCCESSFUL(gst_pad_link(m_decode_tee_pad, sink_pad));
+        if(linked)
+        {
+            // travels up through the tee, rtpsession turns it into an RTCP PLI/FIR so the camera sends an IDR now
+            gst_pad_push_event(sink_pad, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+        }
+        else
+            std::cout << m_name << ": failed to link the decode branch to the tee\n";
+        gst_object_unref(sink_pad);
+        return linked;
+    }
+    /**
+    @brief unlinks the decode branch from the tee once it is idle, stops it and takes it out of the pipeline.
+    m_decode_mutex must be held
+    */
+    void detachDecodeBranch()
+    {
+        if(m_decode_tee_pad != NULL)
+        {
+            if(gst_pad_is_linked(m_decode_tee_pad))
+            {
+                DetachWait wait;
+                wait.unlinked = false;
+
+                // an idle pad runs the probe on this thread before gst_pad_add_probe returns, so wait.mutex can't be held here
+                gst_pad_add_probe(m_decode_tee_pad, GST_PAD_PROBE_TYPE_IDLE, onDecodePadIdle, &wait, NULL);
+                std::unique_lock<std::mutex> lock(wait.mutex);
+                wait.condition.wait(lock, [&wait]{ return wait.unlinked; });
+            }
+
+            gst_element_release_request_pad(m_pipeline.getElementByName("videotee"), m_decode_tee_pad);
+            gst_object_unref(m_decode_tee_pad);
+            m_decode_tee_pad = NULL;
+        }
+
+        const gulong probe = m_keyframe_probe.exchange(0);
+        GstElement* queue = probe != 0 ? m_pipeline.getElementByName(m_decode_chain.front()) : NULL;
+        GstPad* sink_pad = queue != NULL ? gst_element_get_static_pad(queue, "sink") : NULL;
+        if(sink_pad != NULL)
+        {
+            gst_pad_remove_probe(sink_pad, probe);
+            gst_object_unref(sink_pad);
+        }
+        m_pipeline.removeElements(decodeElements());
+    }
+    /**
+    @returns every element of the decode branch, the output branches after the main chain
+    */
+    std::vector<std::string> decodeElements() const
+    {
+        std::vector<std::string> elements = m_decode_chain;
+        // the first element of an output chain is the decoded tee, which is already part of the main chain
+        for(const std::vector<std::string>& output : m_output_chains)
+            elements.insert(elements.end(), output.begin() + 1, output.end());
+        return elements;
+    }
+    /**
+    @brief reads media and encoding-name from application/x-rtp caps
+    @param caps caps of an rtspsrc pad or stream
+    @param media receives the media, EG video
+    @param encoding receives the encoding-name, EG H264
+    @returns false if the caps don't carry both
+    */
+    static bool rtpMedia(const GstCaps* caps, std::string& media, std::string& encoding)
+    {
+        const GstStructure* structure = caps != NULL && gst_caps_get_size(caps) != 0 ? gst_caps_get_structure(caps, 0) : NULL;
+        const gchar* media_name = structure != NULL ? gst_structure_get_string(structure, "media") : NULL;
+        const gchar* encoding_name = structure != NULL ? gst_structure_get_string(structure, "encoding-name") : NULL;
+        if(media_name == NULL || encoding_name == NULL)
+            return false;
+        media = media_name;
+        encoding = encoding_name;
+        return true;
+    }
+    /**
+    @brief See rtpMedia
+    @param pad rtspsrc pad
+    */
+    static bool padMedia(GstPad* pad, std::string& media, std::string& encoding)
+    {
+        GstCaps* caps = gst_pad_get_current_caps(pad);
+        if(caps == NULL)
+            caps = gst_pad_query_caps(pad, NULL);
+        if(caps == NULL)
+            return false;
+        const bool found = rtpMedia(caps, media, encoding);
+        gst_caps_unref(caps);
+        return found;
+    }
+    /**
+    @brief decides which streams of the SDP rtspsrc sets up. Video always, audio only when it is consumed with a known codec,
+    nothing else. Streams that aren't set up are never sent by the camera
+    @param element rtspsrc
+    @param num index of the stream in the SDP
+    @param caps caps of the stream
+    @param user_data RtspStream
+    @returns TRUE to set the stream up
+    */
+    static gboolean onSelectStream(GstElement* element, guint num, GstCaps* caps, gpointer user_data)
+    {
+        RtspStream* stream = static_cast<RtspStream*>(user_data);
+        std::string media;
+        std::string encoding;
+        if(!rtpMedia(caps, media, encoding))
+            return FALSE;
+        if(media == "video")
+            return TRUE;
+        if(media != "audio" || stream->m_config.audio == AudioMode::DROP || !stream->m_config.on_audio)
+            return FALSE;
+
+        if(audioCodecFromEncodingName(encoding) == AudioCodec::NONE)
+        {
+            stream->m_log.log(stream->m_name, "not receiving audio, no chain for " + encoding);
+            return FALSE;
+        }
+        return TRUE;
+    }
+    /**
+    @brief links the pads rtspsrc adds to their depayloaders. A pad whose chain doesn't exist yet is blocked and the chain
+    for its codec is built on the stream context
+    @param element rtspsrc
+    @param pad pad that was added
+    @param user_data RtspStream
+    */
+    static void onPadAdded(GstElement* element, GstPad* pad, gpointer user_data)
+    {
+        RtspStream* stream = static_cast<RtspStream*>(user_data);
+        std::string media;
+        std::string encoding;
+        if(!padMedia(pad, media, encoding))
+            return;
+        if(media == "audio")
+        {
+            stream->addAudioPad(pad, audioCodecFromEncodingName(encoding));
+            return;
+        }
+
+        const VideoCodec codec = media == "video" ? codecFromEncodingName(encoding) : VideoCodec::AUTO;
+        if(codec == VideoCodec::AUTO)
+            return;
+
+        VideoCodec expected = VideoCodec::AUTO;
+        if(stream->m_codec.compare_exchange_strong(expected, codec))
+        {
+            // the first video pad of an auto detected stream. Hold its data until the depayloader exists
+            stream->holdPad(stream->m_pending_video, pad, onBuildChain);
+            return;
+        }
+        if(expected != codec)
+        {
+            stream->m_log.log(stream->m_name, std::string("camera switched to ") + codecElements(codec).name + ", the stream was built for " + codecElements(expected).name);
+            return;
+        }
+        // rtspsrc adds a pad per media, only the first video one feeds the depayloader
+        stream->linkPad(pad, "videodepay");
+    }
+    /**
+    @brief links an audio pad, or builds the audio chain for it once. Audio pads that can't be used are drained, so they never report not-linked
+    @param pad rtspsrc audio pad
+    @param codec codec of the pad
+    */
+    void addAudioPad(GstPad* pad, const AudioCodec codec)
+    {
+        AudioCodec expected = AudioCodec::NONE;
+        if(codec != AudioCodec::NONE && m_audio_codec.compare_exchange_strong(expected, codec))
+        {
+            holdPad(m_pending_audio, pad, onBuildAudioChain);
+            return;
+        }
+        if(codec == expected && m_audio_built.load() && linkPad(pad, "audiodepay"))
+            return;
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, onDrainPad, NULL, NULL);
+    }
+    /**
+    @brief links an rtspsrc pad to the sink pad of an element unless it is linked already
+    @param pad rtspsrc pad
+    @param element_name element to link to
+    @returns true if the pad was linked
+    */
+    bool linkPad(GstPad* pad, const std::string& element_name)
+    {
+        GstElement* element = m_pipeline.getElementByName(element_name);
+        GstPad* sink_pad = element != NULL ? gst_element_get_static_pad(element, "sink") : NULL;
+        if(sink_pad == NULL)
+            return false;
+        const bool linked = !gst_pad_is_linked(sink_pad) && gst_pad_link(pad, sink_pad) == GST_PAD_LINK_OK;
+        gst_object_unref(sink_pad);
+        return linked;
+    }
+    /**
+    @brief blocks a pad and schedules the build of its chain on the stream context
+    @param pending receives the pad
+    @param pad pad to block
+    @param build callback building the chain, gets the RtspStream
+    */
+    void holdPad(PendingPad& pending, GstPad* pad, GSourceFunc build)
+    {
+        pending.pad = GST_PAD(gst_object_ref(pad));
+        pending.probe = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM, onPendingData, NULL, NULL);
+        pending.source = g_idle_source_new();
+        g_source_set_callback(pending.source, build, this, NULL);
+        g_source_attach(pending.source, m_context);
+    }
+    /**
+    @brief cancels a pending chain build and unblocks the pad it was for
+    @param pending pad to release
+    */
+    static void releasePad(PendingPad& pending)
+    {
+        if(pending.source != NULL)
+        {
+            g_source_destroy(pending.source);
+            g_source_unref(pending.source);
+            pending.source = NULL;
+        }
+        if(pending.pad != NULL)
+        {
+            gst_pad_remove_probe(pending.pad, pending.probe);
+            gst_object_unref(pending.pad);
+            pending.pad = NULL;
+            pending.probe = 0;
+        }
+    }
+    /**
+    @brief blocking probe holding the first data of a pad while its chain is built
+    @returns GST_PAD_PROBE_OK, which keeps the pad blocked until the probe is removed
+    */
+    static GstPadProbeReturn onPendingData(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+    {
+        return GST_PAD_PROBE_OK;
+    }
+    /**
+    @brief buffer probe dropping everything a pad without a chain receives
+    @returns GST_PAD_PROBE_DROP
+    */
+    static GstPadProbeReturn onDrainPad(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+    {
+        return GST_PAD_PROBE_DROP;
+    }
+    /**
+    @brief builds the chain for the detected codec and releases the blocked pad
+    @param user_data RtspStream
+    @returns G_SOURCE_REMOVE
+    */
+    static gboolean onBuildChain(gpointer user_data)
+    {
+        RtspStream* stream = static_cast<RtspStream*>(user_data);
+        PendingPad& pending = stream->m_pending_video;
+        g_source_unref(pending.source);
+        pending.source = NULL;
+
+        stream->m_log.log(stream->m_name, std::string("detected ") + stream->elements().name);
+        if(stream->buildChain(true))
+        {
+            if(!stream->linkPad(pending.pad, "videodepay"))
+                stream->m_log.log(stream->m_name, "failed to link rtspsrc to the depayloader");
+        }
+        else
+            std::cout << stream->m_name << ": failed to build the " << stream->elements().name << " chain\n";
+        // unblocking an unlinked pad makes rtspsrc post not-linked, which goes through the usual reconnect
+        releasePad(pending);
+        return G_SOURCE_REMOVE;
+    }
+    /**
+    @brief builds the audio chain for the detected codec and releases the blocked pad. Without a chain the pad is drained,
+    a missing audio decoder never takes the video down
+    @param user_data RtspStream
+    @returns G_SOURCE_REMOVE
+    */
+    static gboolean onBuildAudioChain(gpointer user_data)
+    {
+        RtspStream* stream = static_cast<RtspStream*>(user_data);
+        PendingPad& pending = stream->m_pending_audio;
+        g_source_unref(pending.source);
+        pending.source = NULL;
+
+        if(!stream->buildAudioChain() || !stream->linkPad(pending.pad, "audiodepay"))
+        {
+            stream->m_log.log(stream->m_name, std::string("failed to build the ") + audioCodecElements(stream->m_audio_codec.load()).name + " audio chain, dropping audio");
+            gst_pad_add_probe(pending.pad, GST_PAD_PROBE_TYPE_BUFFER, onDrainPad, NULL, NULL);
+        }
+        releasePad(pending);
+        return G_SOURCE_REMOVE;
+    }
+    /**
+    @brief describes depay -> parse -> decode -> audioconvert -> appsink for the audio codec, builds it into the running pipeline
+    and installs the audio callback. Passthrough stops after the parser
+    @returns true on success false on failure
+    */
+    bool buildAudioChain()
+    {
+        const AudioCodecElements& codec = audioCodecElements(m_audio_codec.load());
+
+        PipelineSpec spec;
+        spec.add(codec.depay, "audiodepay");
+        std::vector<std::string> chain = {"audiodepay"};
+        if(codec.parse != NULL)
+        {
+            spec.add(codec.parse, "audioparse");
+            chain.push_back("audioparse");
+        }
+        if(m_config.audio == AudioMode::DECODE)
+        {
+            if(!codec.decoders.empty())
+            {
+                const std::string decoder = GStreamPipeline::findAvailableFactory(codec.decoders);
+                if(decoder.empty())
+                    return false;
+                spec.add(decoder, "audiodecode");
+                chain.push_back("audiodecode");
+            }
+            spec.add("audioconvert", "audioconvert").linkCaps("audio/x-raw, format=(string)S16LE, layout=(string)interleaved");
+            chain.push_back("audioconvert");
+        }
+        spec.add("appsink", "audiosink").property("sync", false)              // the consumer syncs audio with the frames through the pts
+                                        .property("max-buffers", 64u)        // bounds memory when the consumer stalls
+                                        .property("drop", true);
+        chain.push_back("audiosink");
+        spec.link(chain);
+
+        if(!m_pipeline.build(spec) || !m_pipeline.setEncodedCallback("audiosink", m_config.on_audio) || !m_pipeline.syncElementStates(spec))
+            return false;
+        m_audio_built.store(true);
+        return true;
+    }
+    /**
+    @brief copies a bus message into an event and queues it, if anyone listens
+    @param type event type
+    @param message bus message
+    @param text error or warning text
+    */
+    void queueEvent(const StreamEventType type, GstMessage* message, const char* text = NULL)
+    {
+        if(!m_events)
+            return;
+
+        StreamEvent event;
+        event.type = type;
+        event.stream = m_name;
+        event.source = GST_MESSAGE_SRC_NAME(message) != NULL ? GST_MESSAGE_SRC_NAME(message) : "";
+        event.text = text != NULL ? text : "";
+        event.percent = 0;
+        event.processed = 0;
+        event.dropped = 0;
+        event.time_us = g_get_monotonic_time();
+        if(type == StreamEventType::BUFFERING)
+            gst_message_parse_buffering(message, &event.percent);
+        else if(type == StreamEventType::QOS)
+        {
+            GstFormat format;
+            gst_message_parse_qos_stats(message, &format, &event.processed, &event.dropped);
+        }
+        m_events->push(std::move(event));
+    }
+    /**
+    @brief bus watch callback. Runs on the thread driving the context the stream was attached to
+    @param bus pipeline bus
+    @param message message to handle
+    @param user_data RtspStream
+    @returns TRUE to keep the watch installed
+    */
+    static gboolean onBusMessage(GstBus* bus, GstMessage* message, gpointer user_data)
+    {
+        RtspStream* stream = static_cast<RtspStream*>(user_data);
+
+        switch(GST_MESSAGE_TYPE(message))
+        {
+            case GST_MESSAGE_ERROR:
+            {
+                GError* error = NULL;
+                gchar* debug = NULL;
+                gst_message_parse_error(message, &error, &debug);
+                stream->m_log.log(stream->m_name, std::string("error from ") + GST_MESSAGE_SRC_NAME(message) + ": " + error->message);
+                stream->queueEvent(StreamEventType::ERROR, message, error->message);
+                g_clear_error(&error);
+                g_free(debug);
+                if(stream->isSourceMessage(message))
+                {
+                    stream->finishSetup(false);
+                    stream->scheduleReconnect();
+                }
+                break;
+            }
+            case GST_MESSAGE_EOS:
+                // a camera never ends its stream, the session was torn down on the other side
+                stream->m_log.log(stream->m_name, "end of stream");
+                stream->queueEvent(StreamEventType::EOS, message);
+                stream->finishSetup(false);
+                stream->scheduleReconnect();
+                break;
+            case GST_MESSAGE_WARNING:
+            {
+                GError* error = NULL;
+                gchar* debug = NULL;
+                gst_message_parse_warning(message, &error, &debug);
+                stream->m_log.log(stream->m_name, std::string("warning from ") + GST_MESSAGE_SRC_NAME(message) + ": " + error->message);
+                stream->queueEvent(StreamEventType::WARNING, message, error->message);
+                g_clear_error(&error);
+                g_free(debug);
+                break;
+            }
+            case GST_MESSAGE_LATENCY:
+                // an element changed its latency, redistribute it or the sinks keep waiting on the old value
+                stream->m_pipeline.recalculateLatency();
+                stream->queueEvent(StreamEventType::LATENCY, message);
+                break;
+            case GST_MESSAGE_QOS:
+                stream->queueEvent(StreamEventType::QOS, message);
+                break;
+            case GST_MESSAGE_STREAM_START:
+                stream->queueEvent(StreamEventType::STREAM_START, message);
+                break;
+            case GST_MESSAGE_BUFFERING:
+                // live sources never pause for buffering, the level is only reported
+                stream->queueEvent(StreamEventType::BUFFERING, message);
+                break;
+            case GST_MESSAGE_ELEMENT:
+                stream->handleSegmentMessage(message);
+                break;
+            default:
+                break;
+        }
+        return TRUE;
+    }
+    /**
+    @brief follows the fragment messages splitmuxsink posts and reports every closed segment
+    @param message element message
+    */
+    void handleSegmentMessage(GstMessage* message)
+    {
+        const GstStructure* structure = gst_message_get_structure(message);
+        if(structure == NULL || !m_config.on_segment)
+            return;
+
+        const bool opened = gst_structure_has_name(structure, "splitmuxsink-fragment-opened");
+        if(!opened && !gst_structure_has_name(structure, "splitmuxsink-fragment-closed"))
+            return;
+        GstClockTime running_time = GST_CLOCK_TIME_NONE;
+        gst_structure_get_uint64(structure, "running-time", &running_time);
+        if(opened)
+        {
+            m_segment_start = running_time;
+            return;
+        }
+
+        RecordedSegment segment;
+        const gchar* location = gst_structure_get_string(structure, "location");
+        segment.location = location != NULL ? location : "";
+        segment.start = m_segment_start;
+        segment.duration = GST_CLOCK_TIME_IS_VALID(m_segment_start) && GST_CLOCK_TIME_IS_VALID(running_time) && running_time >= m_segment_start
+                         ? running_time - m_segment_start : GST_CLOCK_TIME_NONE;
+        m_segment_start = GST_CLOCK_TIME_NONE;
+        m_config.on_segment(segment);
+    }
+    /**
+    @brief sets the rtspsrc properties and connects its pad-added signal. Used for the first session and every reconnect
+    @returns true on success false on failure
+    */
+    bool configureSource()
+    {
+        m_pipeline.setElementProperty("rtspsrc", "location", m_config.location.c_str());  // location of the stream
+        m_pipeline.setElementProperty("rtspsrc", "protocols", lowerTransport(m_transport.load()));
+        m_pipeline.applyLatencySettings(m_config.latency, "rtspsrc", std::string(), {});
+
+        // rtpbin maps rtp timestamps through the rtcp sender reports, so buffer running times become capture times
+        if(m_config.measure_latency || m_config.wallclock)
+            m_pipeline.setElementProperty("rtspsrc", "ntp-sync", TRUE);
+        if(m_config.wallclock && m_pipeline.hasElementProperty("rtspsrc", "add-reference-timestamp-meta"))
+            m_pipeline.setElementProperty("rtspsrc", "add-reference-timestamp-meta", TRUE);
+        return m_pipeline.setElementSignal("rtspsrc", "select-stream", G_CALLBACK(onSelectStream), this) &&
+               m_pipeline.setElementSignal("rtspsrc", "pad-added", G_CALLBACK(onPadAdded), this) &&
+               m_pipeline.setElementSignal("rtspsrc", "new-manager", G_CALLBACK(onNewManager), this);
+    }
+    /**
+    @brief buffer probe on the parser sink pad. Records that the current session delivers data
+    @param pad parser sink pad
+    @param info probe info
+    @param user_data RtspStream
+    @returns GST_PAD_PROBE_OK
+    */
+    static GstPadProbeReturn onSourceData(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+    {
+        RtspStream* stream = static_cast<RtspStream*>(user_data);
+        if(G_UNLIKELY(!stream->m_receiving.load(std::memory_order_relaxed)))
+        {
+            stream->m_receiving.store(true, std::memory_order_relaxed);
+            stream->finishSetup(true);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+    /**
+    @brief reports the outcome of the session setup started by start, once
+    @param established true if the session delivers data
+    */
+    void finishSetup(const bool established)
+    {
+        if(m_setup_pending.exchange(false) && m_on_setup)
+            m_on_setup(established);
+    }
+    /**
+    @brief buffer probe on the measured sink pad. Records how long ago the frame was captured
+    @param pad sink pad
+    @param info probe info
+    @param user_data RtspStream
+    @returns GST_PAD_PROBE_OK
+    */
+    static GstPadProbeReturn onSinkBuffer(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+    {
+        RtspStream* stream = static_cast<RtspStream*>(user_data);
+        const GstClockTime pts = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+        GstElement* sink = GST_ELEMENT(GST_PAD_PARENT(pad));
+        if(!GST_CLOCK_TIME_IS_VALID(pts) || sink == NULL)
+            return GST_PAD_PROBE_OK;
+
+        GstEvent* event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+        if(event == NULL)
+            return GST_PAD_PROBE_OK;
+        const GstSegment* segment;
+        gst_event_parse_segment(event, &segment);
+        const GstClockTime running_time = gst_segment_to_running_time(segment, GST_FORMAT_TIME, pts);
+        gst_event_unref(event);
+
+        GstClock* clock = gst_element_get_clock(sink);
+        if(clock == NULL)
+            return GST_PAD_PROBE_OK;
+        const GstClockTime now = gst_clock_get_time(clock) - gst_element_get_base_time(sink);
+        gst_object_unref(clock);
+
+        if(GST_CLOCK_TIME_IS_VALID(running_time) && now > running_time)
+            stream->m_glass_to_glass.record((now - running_time) / GST_USECOND);
+        return GST_PAD_PROBE_OK;
+    }
+    /**
+    @brief buffer probe on the sink frames leave through. Records the time to the first frame after a start or resume
+    @param pad sink pad
+    @param info probe info
+    @param user_data RtspStream
+    @returns GST_PAD_PROBE_OK
+    */
+    static GstPadProbeReturn onFirstFrame(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+    {
+        RtspStream* stream = static_cast<RtspStream*>(user_data);
+        if(G_UNLIKELY(stream->m_time_to_first_frame_us.load(std::memory_order_relaxed) < 0))
+        {
+            gint64 unset = -1;
+            stream->m_time_to_first_frame_us.compare_exchange_strong(unset, g_get_monotonic_time() - stream->m_start_us.load());
+        }
+        return GST_PAD_PROBE_OK;
+    }
+    /**
+    @brief resets the startup timing and changes the pipeline state
+    @param state PLAYING or PAUSED
+    @param callback called once the state is reached or failed. can be empty
+    @returns false if the state change failed right away
+    */
+    bool changeState(const GstState state, state_callback callback)
+    {
+        m_start_us.store(g_get_monotonic_time());
+        m_time_to_playing_us.store(-1);
+        m_time_to_first_frame_us.store(-1);
+        return m_pipeline.changeState(state, [this, state, callback](bool reached)
+        {
+            if(reached && state == GST_STATE_PLAYING)
+                m_time_to_playing_us.store(g_get_monotonic_time() - m_start_us.load());
+            if(callback)
+                callback(reached);
+        });
+    }
+    /**
+    @param message bus message
+    @returns true if the message comes from rtspsrc, one of its internal elements, or the depayloader
+    */
+    bool isSourceMessage(GstMessage* message)
+    {
+        GstObject* source = GST_MESSAGE_SRC(message);
+        GstElement* rtspsrc = m_pipeline.getElementByName("rtspsrc");
+        GstElement* depay = m_pipeline.getElementByName("videodepay");
+        return source != NULL && ((rtspsrc != NULL && (source == GST_OBJECT(rtspsrc) || gst_object_has_as_ancestor(source, GST_OBJECT(rtspsrc)))) ||
+                                  (depay != NULL && source == GST_OBJECT(depay)));
+    }
+    /**
+    @brief arms the reconnect timer unless one is pending. The delay is drawn at random between reconnect_min_ms
+    and a ceiling that doubles with every attempt, so streams dropped by the same network blip spread their reconnects out
+    */
+    void scheduleReconnect()
+    {
+        if(!m_config.reconnect || !m_running.load() || m_reconnect_source != NULL || m_reconnect_queued)
+            return;
+
+        // a session that delivered data counts as a success, the next drop starts from the shortest delay again
+        if(m_receiving.exchange(false))
+            m_reconnect_attempts = 0;
+
+        const guint64 min_ms = std::max<guint>(m_config.reconnect_min_ms, 1);
+        const guint64 max_ms = std::max<guint64>(m_config.reconnect_max_ms, min_ms);
+        const guint64 ceiling = std::min(max_ms, min_ms << std::min<guint>(m_reconnect_attempts + 1, 20));
+        const guint delay_ms = static_cast<guint>(min_ms + g_random_int_range(0, static_cast<gint32>(ceiling - min_ms) + 1));
+
+        m_log.log(m_name, "reconnecting in " + std::to_string(delay_ms) + " ms");
+        m_reconnect_source = g_timeout_source_new(delay_ms);
+        g_source_set_callback(m_reconnect_source, onReconnectTimeout, this, NULL);
+        g_source_attach(m_reconnect_source, m_context);
+    }
+    /**
+    @param transport transport
+    @returns the rtspsrc protocols flag selecting the transport
+    */
+    static GstRTSPLowerTrans lowerTransport(const RtspTransport transport)
+    {
+        switch(transport)
+        {
+            case RtspTransport::UDP_MULTICAST:
+                return GST_RTSP_LOWER_TRANS_UDP_MCAST;
+            case RtspTransport::TCP:
+                return GST_RTSP_LOWER_TRANS_TCP;
+            default:
+                return GST_RTSP_LOWER_TRANS_UDP;
+        }
+    }
+    /**
+    @brief adds the stats of an element to the totals if it is a jitterbuffer
+    @param item GValue holding the element
+    @param user_data JitterbufferTotals
+    */
+    static void addJitterbufferStats(const GValue* item, gpointer user_data)
+    {
+        GstElement* element = GST_ELEMENT(g_value_get_object(item));
+        GstElementFactory* factory = gst_element_get_factory(element);
+        if(factory == NULL || g_strcmp0(gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)), "rtpjitterbuffer") != 0)
+            return;
+
+        GstStructure* stats = NULL;
+        g_object_get(element, "stats", &stats, NULL);
+        if(stats == NULL)
+            return;
+
+        JitterbufferTotals* totals = static_cast<JitterbufferTotals*>(user_data);
+        guint64 value;
+        if(gst_structure_get_uint64(stats, "num-pushed", &value))
+            totals->packets += value;
+        if(gst_structure_get_uint64(stats, "num-lost", &value))
+            totals->lost += value;
+        if(gst_structure_get_uint64(stats, "num-late", &value))
+            totals->late += value;
+        gst_structure_free(stats);
+    }
+    /**
+    @brief reads the jitterbuffers of the current session and adds what changed since the last call to the stream counters
+    @param packets receives the packets pushed since the last call
+    @param lost receives the packets lost since the last call
+    */
+    void sampleJitterbuffers(guint64& packets, guint64& lost)
+    {
+        JitterbufferTotals totals = JitterbufferTotals();
+        GstElement* rtspsrc = m_pipeline.getElementByName("rtspsrc");
+        if(rtspsrc != NULL)
+        {
+            GstIterator* elements = gst_bin_iterate_recurse(GST_BIN(rtspsrc));
+            gst_iterator_foreach(elements, addJitterbufferStats, &totals);
+            gst_iterator_free(elements);
+        }
+
+        // rtspsrc renegotiating a stream recreates its jitterbuffer, which restarts the counters
+        packets = totals.packets >= m_session_packets ? totals.packets - m_session_packets : totals.packets;
+        lost = totals.lost >= m_session_lost ? totals.lost - m_session_lost : totals.lost;
+        const guint64 late = totals.late >= m_session_late ? totals.late - m_session_late : totals.late;
+        m_session_packets = totals.packets;
+        m_session_lost = totals.lost;
+        m_session_late = totals.late;
+
+        m_packets.fetch_add(packets, std::memory_order_relaxed);
+        m_lost.fetch_add(lost, std::memory_order_relaxed);
+        m_late.fetch_add(late, std::memory_order_relaxed);
+    }
+    /**
+    @param buffer rtp packet
+    @returns the rtp seqnum of the packet, -1 if it is too short
+    */
+    static gint rtpSeqnum(GstBuffer* buffer)
+    {
+        guint8 header[4];
+        return gst_buffer_extract(buffer, 0, header, sizeof(header)) == sizeof(header) ? (header[2] << 8) | header[3] : -1;
+    }
+    /**
+    @param info buffer or buffer list probe info
+    @param bytes receives the bytes of the buffers
+    @param count receives the number of buffers
+    @returns the last buffer of the probe, NULL for an empty list
+    */
+    static GstBuffer* probeBuffers(GstPadProbeInfo* info, gsize& bytes, guint& count)
+    {
+        if(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+        {
+            GstBufferList* list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+            count = gst_buffer_list_length(list);
+            bytes = gst_buffer_list_calculate_size(list);
+            return count != 0 ? gst_buffer_list_get(list, count - 1) : NULL;
+        }
+        GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        count = 1;
+        bytes = gst_buffer_get_size(buffer);
+        return buffer;
+    }
+    /**
+    @brief probe on the jitterbuffer sink pad. Records the newest seqnum and the packet size, a flush empties the jitterbuffer
+    @param pad jitterbuffer sink pad
+    @param info probe info
+    @param user_data JitterbufferLevel
+    @returns GST_PAD_PROBE_OK
+    */
+    static GstPadProbeReturn onJitterbufferInput(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+    {
+        JitterbufferLevel* level = static_cast<JitterbufferLevel*>(user_data);
+        if(GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_FLUSH)
+        {
+            if(GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_FLUSH_STOP)
+            {
+                level->received.store(-1, std::memory_order_relaxed);
+                level->pushed.store(-1, std::memory_order_relaxed);
+                level->waiting.store(0, std::memory_order_relaxed);
+            }
+            return GST_PAD_PROBE_OK;
+        }
+
+        gsize bytes;
+        guint count;
+        GstBuffer* last = probeBuffers(info, bytes, count);
+        const gint seqnum = last != NULL ? rtpSeqnum(last) : -1;
+        if(seqnum < 0)
+            return GST_PAD_PROBE_OK;
+
+        // only this streaming thread writes the mean
+        const guint size = static_cast<guint>(bytes / count);
+        const guint mean = level->packet_size.load(std::memory_order_relaxed);
+        level->packet_size.store(mean == 0 ? size : mean - mean / 16 + size / 16, std::memory_order_relaxed);
+        level->received.store(seqnum, std::memory_order_relaxed);
+        if(level->pushed.load(std::memory_order_relaxed) < 0)
+            level->waiting.fetch_add(count, std::memory_order_relaxed);
+        return GST_PAD_PROBE_OK;
+    }
+    /**
+    @brief probe on the jitterbuffer src pad. Records the newest seqnum pushed
+    @param pad jitterbuffer src pad
+    @param info probe info
+    @param user_data JitterbufferLevel
+    @returns GST_PAD_PROBE_OK
+    */
+    static GstPadProbeReturn onJitterbufferOutput(GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+    {
+        gsize bytes;
+        guint count;
+        GstBuffer* last = probeBuffers(info, bytes, count);
+        const gint seqnum = last != NULL ? rtpSeqnum(last) : -1;
+        if(seqnum >= 0)
+            static_cast<JitterbufferLevel*>(user_data)->pushed.store(seqnum, std::memory_order_relaxed);
+        return GST_PAD_PROBE_OK;
+    }
+    /**
+    @brief frees the JitterbufferLevel of a jitterbuffer being finalized
+    */
+    static void freeJitterbufferLevel(gpointer data)
+    {
+        delete static_cast<JitterbufferLevel*>(data);
+    }
+    /**
+    @brief rtspsrc new-manager callback. Every session gets a new rtpbin, its jitterbuffers are measured as they are created
+    @param rtspsrc rtspsrc element
+    @param manager rtpbin of the session
+    @param user_data RtspStream
+    */
+    static void onNewManager(GstElement* rtspsrc, GstElement* manager, gpointer user_data)
+    {
+        g_signal_connect(manager, "new-jitterbuffer", G_CALLBACK(onNewJitterbuffer), user_data);
+    }
+    /**
+    @brief rtpbin new-jitterbuffer callback. Installs the fill probes and the throttle limits on a jitterbuffer
+    @param rtpbin rtpbin
+    @param jitterbuffer new jitterbuffer
+    @param session rtp session id
+    @param ssrc ssrc of the stream
+    @param user_data RtspStream
+    */
+    static void onNewJitterbuffer(GstElement* rtpbin, GstElement* jitterbuffer, guint session, guint ssrc, gpointer user_data)
+    {
+        RtspStream* stream = static_cast<RtspStream*>(user_data);
+        JitterbufferLevel* level = new JitterbufferLevel();
+        g_object_set_data_full(G_OBJECT(jitterbuffer), "rtsp-level", level, freeJitterbufferLevel);
+
+        GstPad* sink_pad = gst_element_get_static_pad(jitterbuffer, "sink");
+        GstPad* src_pad = gst_element_get_static_pad(jitterbuffer, "src");
+        if(sink_pad != NULL)
+        {
+            gst_pad_add_probe(sink_pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST | GST_PAD_PROBE_TYPE_EVENT_FLUSH),
+                              onJitterbufferInput, level, NULL);
+            gst_object_unref(sink_pad);
+        }
+        if(src_pad != NULL)
+        {
+            gst_pad_add_probe(src_pad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST), onJitterbufferOutput, level, NULL);
+            gst_object_unref(src_pad);
+        }
+
+        // a throttled stream that reconnects keeps its jitterbuffers short
+        std::lock_guard<std::mutex> lock(stream->m_throttle_mutex);
+        if(stream->m_throttle >= StreamThrottle::QUEUES)
+        {
+            const QueueLimits limits = stream->queueLimits(true);
+            g_object_set(jitterbuffer, "latency", limits.latency_ms, "drop-on-latency", limits.drop_on_latency, NULL);
+        }
+    }
+    /**
+    @param item GValue holding an element
+    @returns the factory name of the element, NULL if it has none
+    */
+    static const gchar* factoryName(const GValue* item)
+    {
+        GstElementFactory* factory = gst_element_get_factory(GST_ELEMENT(g_value_get_object(item)));
+        return factory != NULL ? gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)) : NULL;
+    }
+    /**
+    @brief adds the memory an element holds to the usage if it is a jitterbuffer or a queue
+    @param item GValue holding the element
+    @param user_data ElementUsage
+    */
+    static void addElementUsage(const GValue* item, gpointer user_data)
+    {
+        ElementUsage* usage = static_cast<ElementUsage*>(user_data);
+        GObject* element = G_OBJECT(g_value_get_object(item));
+        const gchar* factory = factoryName(item);
+        if(g_strcmp0(factory, "rtpjitterbuffer") == 0)
+        {
+            const JitterbufferLevel* level = static_cast<const JitterbufferLevel*>(g_object_get_data(element, "rtsp-level"));
+            if(level != NULL)
+                usage->jitterbuffers += level->bytes();
+        }
+        else if(g_strcmp0(factory, "queue") == 0)
+        {
+            guint bytes = 0;
+            g_object_get(element, "current-level-bytes", &bytes, NULL);
+            usage->queues += bytes;
+        }
+    }
+    /**
+    @param throttled true for the QUEUES throttle, false for the configured limits
+    @returns the jitterbuffer and queue limits
+    */
+    QueueLimits queueLimits(const bool throttled) const
+    {
+        if(throttled)
+            return {std::min(m_config.latency.latency_ms, 100u), TRUE, 1024u * 1024u, 200 * GST_MSECOND};
+        // queues that don't leak are built with the queue defaults
+        return {m_config.latency.latency_ms, m_config.latency.drop_on_latency, 10u * 1024u * 1024u, GST_SECOND};
+    }
+    /**
+    @brief applies limits to an element if it is a jitterbuffer or a queue that doesn't leak. Leaky queues already hold a couple of frames
+    @param item GValue holding the element
+    @param user_data QueueLimits
+    */
+    static void applyQueueLimits(const GValue* item, gpointer user_data)
+    {
+        const QueueLimits* limits = static_cast<const QueueLimits*>(user_data);
+        GObject* element = G_OBJECT(g_value_get_object(item));
+        const gchar* factory = factoryName(item);
+        if(g_strcmp0(factory, "rtpjitterbuffer") == 0)
+            g_object_set(element, "latency", limits->latency_ms, "drop-on-latency", limits->drop_on_latency, NULL);
+        else if(g_strcmp0(factory, "queue") == 0)
+        {
+            gint leaky = 0;
+            g_object_get(element, "leaky", &leaky, NULL);
+            if(leaky == 0)
+                g_object_set(element, "max-size-bytes", limits->max_bytes, "max-size-time", limits->max_time, NULL);
+        }
+    }
+    /**
+    @returns bytes of one decoded frame at the video sink, 0 before caps are negotiated
+    */
+    gsize frameBytes()
+    {
+        GstElement* sink = m_pipeline.findElement("videosink");
+        if(sink == NULL)
+            return 0;
+        GstPad* pad = gst_element_get_static_pad(sink, "sink");
+        GstCaps* caps = pad != NULL ? gst_pad_get_current_caps(pad) : NULL;
+        GstVideoInfo info;
+        const gsize bytes = caps != NULL && gst_video_info_from_caps(&info, caps) ? GST_VIDEO_INFO_SIZE(&info) : 0;
+        if(caps != NULL)
+            gst_caps_unref(caps);
+        if(pad != NULL)
+            gst_object_unref(pad);
+        gst_object_unref(sink);
+        return bytes;
+    }
+    /**
+    @brief bus sync handler, runs on the thread that posted the message. Accounts the cpu time of the streaming threads
+    @param bus pipeline bus
+    @param message message
+    @param user_data RtspStream
+    @returns GST_BUS_PASS, the bus watch still gets every message
+    */
+    static GstBusSyncReply onSyncMessage(GstBus* bus, GstMessage* message, gpointer user_data)
+    {
+        static_cast<RtspStream*>(user_data)->m_cpu.onMessage(message);
+        return GST_BUS_PASS;
+    }
+    /**
+    @brief moves the session to a more reliable transport and reconnects. Does nothing on TCP
+    @param loss_ratio loss that caused the switch, reported to on_transport_switch
+    @returns true if the transport changed
+    */
+    bool fallBack(const double loss_ratio)
+    {
+        const RtspTransport from = m_transport.load();
+        if(!m_config.transport_fallback || from == RtspTransport::TCP)
+            return false;
+
+        const RtspTransport to = static_cast<RtspTransport>(static_cast<int>(from) + 1);
+        m_log.log(m_name, std::string("switching transport from ") + transportName(from) + " to " + transportName(to) +
+                          ", loss " + std::to_string(loss_ratio * 100.0) + "%");
+        m_transport.store(to);
+        m_transport_switches.fetch_add(1, std::memory_order_relaxed);
+        if(m_config.on_transport_switch)
+            m_config.on_transport_switch(from, to, loss_ratio);
+        return true;
+    }
+    /**
+    @brief loss timer callback. Measures the loss of the last window and falls back when it crosses loss_threshold
+    @param user_data RtspStream
+    @returns G_SOURCE_CONTINUE
+    */
+    static gboolean onLossTimer(gpointer user_data)
+    {
+        RtspStream* stream = static_cast<RtspStream*>(user_data);
+        if(!stream->m_running.load() || stream->m_reconnect_source != NULL || stream->m_reconnect_queued)
+            return G_SOURCE_CONTINUE;
+
+        guint64 packets;
+        guint64 lost;
+        stream->sampleJitterbuffers(packets, lost);
+
+        // too few packets to tell loss from noise, e.g. a stream that just started
+        const guint64 expected = packets + lost;
+        if(expected < 100)
+            return G_SOURCE_CONTINUE;
+
+        const double loss_ratio = static_cast<double>(lost) / expected;
+        stream->m_loss_ratio.store(loss_ratio, std::memory_order_relaxed);
+        if(loss_ratio > stream->m_config.loss_threshold && stream->fallBack(loss_ratio))
+            stream->requestReconnect();
+        return G_SOURCE_CONTINUE;
+    }
+    /**
+    @brief reconnect timer callback
+    @param user_data RtspStream
+    @returns G_SOURCE_REMOVE
+    */
+    static gboolean onReconnectTimeout(gpointer user_data)
+    {
+        RtspStream* stream = static_cast<RtspStream*>(user_data);
+        g_source_unref(stream->m_reconnect_source);
+        stream->m_reconnect_source = NULL;
+
+        if(!stream->m_running.load())
+            return G_SOURCE_REMOVE;
+
+        // sessions that keep failing without a single packet usually mean udp is blocked on the way
+        if(stream->m_reconnect_attempts >= 2)
+            stream->fallBack(1.0);
+        stream->requestReconnect();
+        return G_SOURCE_REMOVE;
+    }
+    /**
+    @brief reconnects now if the admission callback hands out a setup slot, otherwise waits for admitReconnect.
+    Without an admission callback the stream reconnects right away
+    */
+    void requestReconnect()
+    {
+        if(m_on_admission && !m_on_admission())
+        {
+            m_reconnect_queued = true;
+            return;
+        }
+        reconnectAdmitted();
+    }
+    /**
+    @brief reconnects holding a setup slot. The slot is given back through the setup callback once the session delivers or fails
+    */
+    void reconnectAdmitted()
+    {
+        if(m_on_admission)
+            m_setup_pending.store(true);
+        if(!reconnect())
+        {
+            finishSetup(false);
+            scheduleReconnect();
+        }
+    }
+    /**
+    @brief replaces rtspsrc, which issues a fresh DESCRIBE/SETUP/PLAY, and resets the depayloader.
+    Everything after the depayloader keeps running with its negotiated caps, it is only flushed so elements that saw EOS accept data again
+    @returns true if the new session was started
+    */
+    bool reconnect()
+    {
+        // the new session counts as delivering only once its own data reaches the parser, which also releases its setup slot
+        m_receiving.store(false);
+        m_reconnect_attempts++;
+        m_reconnects.fetch_add(1, std::memory_order_relaxed);
+
+        // count what the old session delivered before its jitterbuffers go away
+        guint64 packets;
+        guint64 lost;
+        sampleJitterbuffers(packets, lost);
+        m_session_packets = 0;
+        m_session_lost = 0;
+        m_session_late = 0;
+
+        // the pads pending builds wait for belong to the old rtspsrc, the new session detects the codecs again
+        releasePad(m_pending_audio);
+        if(!m_audio_built.load())
+            m_audio_codec.store(AudioCodec::NONE);
+        else
+            m_pipeline.setElementState("audiodepay", GST_STATE_NULL);
+
+        if(!m_chain_built.load())
+        {
+            releasePad(m_pending_video);
+            m_codec.store(m_config.codec);
+            return m_pipeline.recreateElement("rtspsrc") && configureSource() &&
+                   (!m_audio_built.load() || gst_element_sync_state_with_parent(m_pipeline.getElementByName("audiodepay"))) &&
+                   gst_element_sync_state_with_parent(m_pipeline.getElementByName("rtspsrc"));
+        }
+
+        m_pipeline.setElementState("videodepay", GST_STATE_NULL);
+        if(!m_pipeline.recreateElement("rtspsrc") || !configureSource())
+            return false;
+
+        // drops whatever the old session left queued and references the decoders hold from it
+        GstPad* parse_pad = gst_element_get_static_pad(m_pipeline.getElementByName("videoparse"), "sink");
+        gst_pad_send_event(parse_pad, gst_event_new_flush_start());
+        gst_pad_send_event(parse_pad, gst_event_new_flush_stop(FALSE));
+        gst_object_unref(parse_pad);
+
+        return gst_element_sync_state_with_parent(m_pipeline.getElementByName("videodepay")) &&
+               (!m_audio_built.load() || gst_element_sync_state_with_parent(m_pipeline.getElementByName("audiodepay"))) &&
+               gst_element_sync_state_with_parent(m_pipeline.getElementByName("rtspsrc"));
+    }
+    /**
+    @brief starts a branch after the parser. Branches hanging off the tee get their own queue, so a slow branch never stalls the others
+    @param spec spec to add the queue to
+    @param chain receives the first elements of the branch
+    @param queue_name name of the queue to add when tee is true
+    @param tee true if the parser feeds a tee
+    */
+    void startBranch(PipelineSpec& spec, std::vector<std::string>& chain, const std::string& queue_name, const bool tee)
+    {
+        chain.assign(1, tee ? "videotee" : "videoparse");
+        if(!tee)
+            return;
+
+        spec.add("queue", queue_name);
+        chain.push_back(queue_name);
+    }
+    /**
+    @brief adds a queue starting a new streaming thread and appends it to the chain
+    @param spec spec to add the queue to
+    @param chain chain to extend
+    @param queue_name name of the queue
+    @param leaky drop the oldest buffer when the next stage falls behind. Only for raw video, a dropped access unit corrupts every frame up to the next keyframe
+    */
+    void addStageQueue(PipelineSpec& spec, std::vector<std::string>& chain, const std::string& queue_name, const bool leaky)
+    {
+        ElementSpec& queue = spec.add("queue", queue_name);
+        chain.push_back(queue_name);
+
+        if(leaky)
+        {
+            queue.property("max-size-buffers", 2u)                          // a couple of frames are enough to decouple the stages
+                 .property("max-size-bytes", 0u)
+                 .property("max-size-time", G_GUINT64_CONSTANT(0))
+                 .property("leaky", "downstream");                          // drop the oldest frame
+        }
+    }
+    /**
+    @returns threads videoscale and videoconvert split each frame across
+    */
+    guint convertThreads() const
+    {
+        return m_config.convert_threads != 0 ? m_config.convert_threads : std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    /**
+    @brief describes decode -> conversions -> video sink
+    @param spec spec to extend
+    @param tee true if the parser feeds a tee
+    @returns false if no decoder is available
+    */
+    bool describeDecodeBranch(PipelineSpec& spec, const bool tee)
+    {
+        const bool to_appsink = m_config.on_frame || m_config.frame_ring || !m_config.shm_name.empty();
+        // device memory only pays off when frames are handed to a consumer, a video sink would download them again
+        m_device = m_config.gpu_memory && (m_config.on_frame || m_config.frame_ring) && gpuPathAvailable();
+        if(m_device && !m_config.shm_name.empty())
+        {
+            std::cout << m_name << ": shared memory export needs host frames, decoding to system memory\n";
+            m_device = false;
+        }
+        if(m_device && !m_config.outputs.empty())
+        {
+            std::cout << m_name << ": output branches crop in system memory, decoding to system memory\n";
+            m_device = false;
+        }
+
+        m_decoder = m_device ? elements().cuda_decoder : selectDecoder();
+        if(m_decoder.empty())
+        {
+            std::cout << m_name << ": no " << elements().name << " decoder available\n";
+            return false;
+        }
+        std::cout << m_name << ": using decoder " << m_decoder << '\n';
+
+        std::vector<std::string> chain;
+        startBranch(spec, chain, "decodequeue", tee);
+        // the decimator reads nal headers, so hand the decoder byte-stream access units
+        spec.find(chain.back())->linkCaps(elements().frame_caps);
+        spec.add(m_decoder, "videodecode");
+        chain.push_back("videodecode");
+        if(m_config.stage_queues)
+            addStageQueue(spec, chain, "decodedqueue", true);
+        if(!m_config.outputs.empty())
+        {
+            // one decode feeds every output, the main output gets its own queue like the output branches
+            spec.add("tee", "decodedtee");
+            chain.push_back("decodedtee");
+            addStageQueue(spec, chain, "mainqueue", true);
+            describeOutputBranches(spec);
+        }
+        const size_t decoded_end = chain.size();
+
+        // only insert the conversions that can change something, each one is a full pass over the frame.
+        // A reconfigurable branch keeps all of them, they pass frames through untouched while their caps match
+        const bool all = m_config.reconfigurable;
+        if(m_device)
+        {
+            // nvdec only outputs CUDA memory when downstream asks for it. cudaupload passes device memory through untouched
+            // and uploads if the decoder fell back to system memory, so the branch always negotiates
+            spec.add("cudaupload", "cudaupload");
+            chain.push_back("cudaupload");
+        }
+        if(all || m_config.width > 0 || m_config.height > 0)
+        {
+            if(m_device)
+                spec.add("cudascale", "videoscale");
+            else
+                spec.add("videoscale", "videoscale").property("n-threads", convertThreads(), true);
+            chain.push_back("videoscale");
+        }
+        if(all || m_config.fps_n > 0)
+        {
+            ElementSpec& rate = spec.add("videorate", "videorate");
+            chain.push_back("videorate");
+            if(m_config.target_fps > 0.0 || m_config.keyframes_only)
+                rate.property("drop-only", true);                           // never duplicate the frames the decimator dropped
+        }
+        if(m_device && (all || !m_config.format.empty()))
+        {
+            spec.add("cudaconvert", "videoconvert");
+            chain.push_back("videoconvert");
+        }
+        else if(all || (!m_config.format.empty() && !factoryOnlyOutputs(m_decoder, m_config.format)))
+        {
+            spec.add("videoconvert", "videoconvert").property("n-threads", convertThreads(), true);
+            chain.push_back("videoconvert");
+        }
+        if(m_config.stage_queues && chain.size() != decoded_end)
+            addStageQueue(spec, chain, "convertedqueue", true);
+
+        const std::string output_caps = outputCaps(outputFormat(), m_device);
+        if(all)
+        {
+            // a named capsfilter instead of link caps, reconfigure sets new caps on it and the branch renegotiates.
+            // delayed keeps accepting the old caps for the frames already on their way
+            spec.add("capsfilter", "outputcaps").property("caps", output_caps.empty() ? std::string("video/x-raw") : output_caps)
+                                                .property("caps-change-mode", "delayed", true);
+            chain.push_back("outputcaps");
+        }
+        else if(!output_caps.empty())
+            spec.find(chain.back())->linkCaps(output_caps);
+
+        ElementSpec& sink = spec.add(to_appsink ? "appsink" : "autovideosink", "videosink");
+        chain.push_back("videosink");
+        if(to_appsink)
+        {
+            sink.property("max-buffers", 2u)                                // never queue more than a couple of frames
+                .property("drop", true);                                    // drop old frames instead of blocking the decoder
+        }
+        m_decode_chain.assign(chain.begin() + 1, chain.end());
+
+        // a lazy branch stays unlinked until the first subscriber attaches it to the tee
+        if(!m_config.lazy_decode)
+            spec.link(chain);
+        return true;
+    }
+    /**
+    @brief describes decoded tee -> queue -> videocrop -> videoscale -> videoconvert -> appsink for every OutputBranch.
+    Each branch only gets the conversions it needs
+    @param spec spec to extend
+    */
+    void describeOutputBranches(PipelineSpec& spec)
+    {
+        m_output_chains.clear();
+        for(size_t i = 0; i < m_config.outputs.size(); i++)
+        {
+            const OutputBranch& output = m_config.outputs[i];
+            const std::string index = std::to_string(i);
+            std::vector<std::string> chain = {"decodedtee"};
+            // leaky, a slow consumer of one output never holds back the others
+            addStageQueue(spec, chain, "outputqueue" + index, true);
+
+            if(output.crop_left > 0 || output.crop_top > 0 || output.crop_right > 0 || output.crop_bottom > 0)
+            {
+                spec.add("videocrop", "outputcrop" + index).property("left", output.crop_left)
+                                                           .property("top", output.crop_top)
+                                                           .property("right", output.crop_right)
+                                                           .property("bottom", output.crop_bottom);
+                chain.push_back("outputcrop" + index);
+            }
+            if(output.output.width > 0 || output.output.height > 0)
+            {
+                spec.add("videoscale", "outputscale" + index).property("n-threads", convertThreads(), true);
+                chain.push_back("outputscale" + index);
+            }
+            if(output.output.fps_n > 0)
+            {
+                spec.add("videorate", "outputrate" + index).property("drop-only", true);
+                chain.push_back("outputrate" + index);
+            }
+            if(!output.output.format.empty())
+            {
+                spec.add("videoconvert", "outputconvert" + index).property("n-threads", convertThreads(), true);
+                chain.push_back("outputconvert" + index);
+            }
+
+            const std::string caps = outputCaps(output.output, false);
+            if(!caps.empty())
+                spec.find(chain.back())->linkCaps(caps);
+            spec.add("appsink", "outputsink" + index).property("max-buffers", 2u)
+                                                      .property("drop", true);
+            chain.push_back("outputsink" + index);
+
+            if(!m_config.lazy_decode)
+                spec.link(chain);
+            m_output_chains.push_back(chain);
+        }
+    }
+    /**
+    @brief installs the decimator, the decoder tuning and the frame delivery once the decode branch exists
+    @returns true on success false on failure
+    */
+    bool setupDecodeBranch()
+    {
+        m_decimator.install(m_pipeline.getElementByName("videodecode"), m_codec.load());
+        m_pipeline.applyLatencySettings(m_config.latency, std::string(), "videodecode", {"videosink"});
+
+        if(m_config.on_frame || m_config.frame_ring || !m_config.shm_name.empty())
+        {
+            if(m_config.frame_ring)
+                m_pipeline.setFrameRing("videosink", m_config.frame_ring.get());
+            else if(!m_config.shm_name.empty())
+            {
+                // one copy into the shared ring, then the in process callback sees the same mapped frame
+                m_shared.reset(new SharedFrameWriter(m_config.shm_name, m_config.shm_slots));
+                SharedFrameWriter* shared = m_shared.get();
+                frame_callback on_frame = m_config.on_frame;
+                m_pipeline.setFrameCallback("videosink", [shared, on_frame](const VideoFramePtr& frame)
+                {
+                    shared->publish(*frame);
+                    if(on_frame)
+                        on_frame(frame);
+                });
+            }
+            else
+                m_pipeline.setFrameCallback("videosink", m_config.on_frame);
+
+            // frames live in the appsink queue, the ring, and with the consumer at the same time
+            const guint in_flight = 2u + (m_config.frame_ring ? static_cast<guint>(m_config.frame_ring->capacity()) : 1u);
+            // the cuda elements bring their own device memory pools
+            if(m_config.frame_pool && !m_device && !m_pipeline.setBufferPool("videosink", in_flight + 2u))
+                return false;
+        }
+
+        for(size_t i = 0; i < m_output_chains.size(); i++)
+        {
+            const std::string& sink = m_output_chains[i].back();
+            if(m_config.outputs[i].on_frame)
+                m_pipeline.setFrameCallback(sink, m_config.outputs[i].on_frame);
+            else
+                std::cout << m_name << ": output " << m_config.outputs[i].name << " has no frame callback\n";
+            m_pipeline.applyLatencySettings(m_config.latency, std::string(), std::string(), {sink});
+            // a branch that only crops hands out the decoder buffers, there is nothing to render into the pool
+            if(m_config.frame_pool && m_output_chains[i].size() > 3 && !m_pipeline.setBufferPool(sink, 5u))
+                return false;
+        }
+
+        // and out of the pipeline, so it doesn't take part in state changes
+        if(m_config.lazy_decode)
+            return m_pipeline.removeElements(decodeElements());
+        return true;
+    }
+    /**
+    @brief describes the appsink delivering compressed access units
+    @param spec spec to extend
+    @param tee true if the parser feeds a tee
+    */
+    void describeEncodedBranch(PipelineSpec& spec, const bool tee)
+    {
+        std::vector<std::string> chain;
+        startBranch(spec, chain, "encodedqueue", tee);
+
+        // one complete frame per buffer, with start codes for h264 and h265
+        spec.find(chain.back())->linkCaps(elements().frame_caps);
+        spec.add("appsink", "encodedsink").property("sync", false);        // hand access units out as soon as they are parsed
+        chain.push_back("encodedsink");
+        spec.link(chain);
+    }
+    /**
+    @returns callback of the encoded appsink, feeding the pre-event buffer and then the access unit callback
+    */
+    encoded_callback encodedCallback() const
+    {
+        if(!m_config.pre_event)
+            return m_config.on_access_unit;
+
+        PreEventBuffer* pre_event = m_config.pre_event.get();
+        if(!m_config.on_access_unit)
+            return [pre_event](const EncodedFramePtr& frame){ pre_event->push(frame); };
+        encoded_callback on_access_unit = m_config.on_access_unit;
+        return [pre_event, on_access_unit](const EncodedFramePtr& frame)
+        {
+            pre_event->push(frame);
+            on_access_unit(frame);
+        };
+    }
+    /**
+    @returns muxer of the recording, empty for the raw parser output
+    */
+    std::string recordMuxer() const
+    {
+        const bool segmented = m_config.record_location.find('%') != std::string::npos;
+        switch(m_config.record_format)
+        {
+            case RecordFormat::MP4:
+            case RecordFormat::FRAGMENTED_MP4:
+                return "mp4mux";
+            case RecordFormat::MPEG_TS:
+                if(m_codec.load() == VideoCodec::H264 || m_codec.load() == VideoCodec::H265)
+                    return "mpegtsmux";
+                std::cout << m_name << ": mpeg-ts can't carry " << elements().name << ", recording with " << elements().segment_muxer << '\n';
+                return elements().segment_muxer;
+            case RecordFormat::MATROSKA:
+                return "matroskamux";
+            default:
+                return segmented ? elements().segment_muxer : std::string();
+        }
+    }
+    /**
+    @brief describes the recording sink. A location containing a % format writes segments with splitmuxsink,
+    anything else writes one file with filesink, muxed when a record format is set
+    @param spec spec to extend
+    @param tee true if the parser feeds a tee
+    */
+    void describeRecordBranch(PipelineSpec& spec, const bool tee)
+    {
+        const bool segmented = m_config.record_location.find('%') != std::string::npos;
+        const std::string muxer = recordMuxer();
+
+        // the branch gets its own parser so the muxer can negotiate avc without forcing it on the other branches
+        std::vector<std::string> chain;
+        startBranch(spec, chain, "recordqueue", tee);
+        spec.add(elements().parse, "recordparse");
+        chain.push_back("recordparse");
+        if(segmented)
+        {
+            // the muxer and the file sink are handed to splitmuxsink in setupRecordBranch
+            spec.add("splitmuxsink", "recordsink").property("location", m_config.record_location)
+                                                  .property("max-size-time", m_config.segment_duration)
+                                                  .property("send-keyframe-requests", m_config.keyframe_requests, true);
+        }
+        else
+        {
+            if(!muxer.empty())
+            {
+                ElementSpec& mux = spec.add(muxer, "recordmux");
+                chain.push_back("recordmux");
+                if(m_config.record_format == RecordFormat::FRAGMENTED_MP4)
+                    mux.property("fragment-duration", m_config.fragment_ms).property("streamable", true);
+            }
+            ElementSpec& sink = spec.add("filesink", "recordsink").property("location", m_config.record_location);
+            if(m_config.write_buffer != 0)
+                sink.property("buffer-mode", "full").property("buffer-size", m_config.write_buffer);
+        }
+        chain.push_back("recordsink");
+        spec.link(chain);
+    }
+    /**
+    @brief hands splitmuxsink its muxer and, with a write buffer, its file sink. Object properties can't go through a PipelineSpec
+    @returns true on success false on failure
+    */
+    bool setupRecordBranch()
+    {
+        if(m_config.record_location.find('%') == std::string::npos)
+            return true;
+
+        const std::string muxer_name = recordMuxer();
+        GstElement* muxer = FactoryCache::instance().create(muxer_name, "recordmux");
+        if(muxer == NULL)
+        {
+            std::cout << m_name << ": no " << muxer_name << " to record with\n";
+            return false;
+        }
+        if(m_config.record_format == RecordFormat::FRAGMENTED_MP4)
+            g_object_set(G_OBJECT(muxer), "fragment-duration", m_config.fragment_ms, "streamable", TRUE, NULL);
+        // splitmuxsink sinks the floating references itself
+        m_pipeline.setElementProperty("recordsink", "muxer", muxer);
+
+        if(m_config.write_buffer != 0)
+        {
+            GstElement* sink = FactoryCache::instance().create("filesink", "recordfile");
+            if(sink == NULL)
+                return false;
+            gst_util_set_object_arg(G_OBJECT(sink), "buffer-mode", "full");
+            g_object_set(G_OBJECT(sink), "buffer-size", m_config.write_buffer, NULL);
+            m_pipeline.setElementProperty("recordsink", "sink", sink);
+        }
+        return true;
+    }
+    /**
+    @brief describes everything after rtspsrc for the stream codec, builds it in one validated pass and installs callbacks and probes
+    @param running the pipeline is already running, so the new elements are brought up to its state
+    @returns true on success false on failure
+    */
+    bool buildChain(const bool running)
+    {
+        const bool record = !m_config.record_location.empty();
+        const bool deliver_encoded = m_config.on_access_unit || m_config.pre_event;
+        const int branches = (m_config.decode ? 1 : 0) + (record ? 1 : 0) + (deliver_encoded ? 1 : 0);
+        const bool tee = branches > 1 || (m_config.decode && m_config.lazy_decode);
+
+        PipelineSpec spec;
+        spec.add(elements().depay, "videodepay");
+        std::vector<std::string> chain = {"videodepay"};
+        if(m_config.stage_queues)
+            addStageQueue(spec, chain, "depayqueue", false);
+
+        ElementSpec& parse = spec.add(elements().parse, "videoparse");
+        chain.push_back("videoparse");
+        if(record || deliver_encoded)
+            parse.property("config-interval", -1, true);                    // repeat the parameter sets on every keyframe so any keyframe can start a file
+        if(tee)
+        {
+            spec.add("tee", "videotee");
+            chain.push_back("videotee");
+        }
+        spec.link(chain);
+
+        if(m_config.decode && !describeDecodeBranch(spec, tee))
+            return false;
+        if(deliver_encoded)
+            describeEncodedBranch(spec, tee);
+        if(record)
+            describeRecordBranch(spec, tee);
+
+        if(!m_pipeline.build(spec))
+            return false;
+        if(m_config.decode && !setupDecodeBranch())
+            return false;
+        if(record && !setupRecordBranch())
+            return false;
+        if(deliver_encoded)
+            m_pipeline.setEncodedCallback("encodedsink", encodedCallback());
+
+        if(m_config.instrument)
+            m_pipeline.enableInstrumentation();
+
+        GstPad* parse_pad = gst_element_get_static_pad(m_pipeline.getElementByName("videoparse"), "sink");
+        gst_pad_add_probe(parse_pad, GST_PAD_PROBE_TYPE_BUFFER, onSourceData, this, NULL);
+        gst_object_unref(parse_pad);
+
+        // measured where frames leave the pipeline, decoded frames if there are any
+        GstElement* measured = m_pipeline.getElementByName(m_config.decode ? "videosink" : "encodedsink");
+        GstPad* sink_pad = m_config.measure_latency && measured != NULL ? gst_element_get_static_pad(measured, "sink") : NULL;
+        if(sink_pad != NULL)
+        {
+            gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, onSinkBuffer, this, NULL);
+            gst_object_unref(sink_pad);
+        }
+
+        GstElement* first = m_pipeline.getElementByName(m_config.decode ? "videosink" : "encodedsink");
+        GstPad* first_pad = first != NULL ? gst_element_get_static_pad(first, "sink") : NULL;
+        if(first_pad != NULL)
+        {
+            gst_pad_add_probe(first_pad, GST_PAD_PROBE_TYPE_BUFFER, onFirstFrame, this, NULL);
+            gst_object_unref(first_pad);
+        }
+
+        if(running && !m_pipeline.syncElementStates(spec))
+            return false;
+
+        // an output changed while the chain was being built
+        if(m_config.decode && m_config.reconfigurable)
+        {
+            std::lock_guard<std::mutex> lock(m_output_mutex);
+            m_chain_built.store(true);
+            applyOutput(m_output);
+        }
+
+        // subscribers that came before the codec was known attach the lazy branch now
+        std::lock_guard<std::mutex> lock(m_decode_mutex);
+        m_chain_built.store(true);
+        if(m_config.decode && m_config.lazy_decode && m_decode_subscribers != 0 && m_decode_tee_pad == NULL && !attachDecodeBranch())
+        {
+            m_decode_subscribers = 0;
+            detachDecodeBranch();
+        }
+        return true;
+    }
+    /**
+    @brief builds rtspsrc, and the rest of the stream right away when the codec is configured
+    @returns true on success false on failure
+    */
+    bool build()
+    {
+        if(!m_config.decode && m_config.record_location.empty() && !m_config.on_access_unit && !m_config.pre_event)
+        {
+            std::cout << m_name << ": nothing consumes the stream, enable decode, recording or access unit delivery\n";
+            return false;
+        }
+
+        PipelineSpec spec;
+        spec.add("rtspsrc", "rtspsrc");
+        if(!m_pipeline.build(spec))
+            return false;
+        if(m_codec.load() != VideoCodec::AUTO && !buildChain(false))
+            return false;
+        return configureSource();
+    }
+
+public:
+    /**
+    @brief builds the stream pipeline
+    @param name name of the stream, also used as the pipeline name
+    @param config stream settings
+    @param context context the bus is dispatched on. When NULL gstreamer is initialized and the pipeline gets its own main loop
+    */
+    RtspStream(const std::string& name, const StreamConfig& config, GMainContext* context = NULL)
+        : m_name(name), m_config(config), m_cpu(), m_pipeline(name, context == NULL, context == NULL), m_decoder(), m_device(false), m_output_mutex(),
+          m_output{config.format, config.width, config.height, config.fps_n, config.fps_d}, m_decimator(config.target_fps, config.keyframes_only),
+          m_codec(config.codec), m_chain_built(false), m_pending_video(), m_audio_codec(AudioCodec::NONE), m_audio_built(false), m_pending_audio(),
+          m_decode_mutex(), m_decode_subscribers(0), m_decode_chain(), m_output_chains(), m_decode_tee_pad(NULL), m_keyframe_probe(0),
+          m_context(context), m_reconnect_source(NULL), m_reconnect_attempts(0), m_reconnect_queued(false), m_running(false), m_receiving(false), m_reconnects(0),
+          m_transport(config.transport), m_loss_source(NULL), m_session_packets(0), m_session_lost(0), m_session_late(0),
+          m_packets(0), m_lost(0), m_late(0), m_transport_switches(0), m_loss_ratio(0.0), m_glass_to_glass(),
+          m_on_setup(), m_on_admission(), m_setup_pending(false), m_start_us(0), m_time_to_playing_us(-1), m_time_to_first_frame_us(-1), m_standby(false),
+          m_shared(), m_events(config.events), m_log(), m_segment_start(GST_CLOCK_TIME_NONE),
+          m_throttle_mutex(), m_throttle(StreamThrottle::NONE), m_target_fps(config.target_fps), m_keyframes_only(config.keyframes_only), m_throttle_paused(false)
+    {
+        if(!build())
+            std::cout << "Failed to build stream " << m_name << '\n';
+        if(m_config.wallclock)
+            m_pipeline.useRealtimeClock();
+        m_pipeline.attachBusWatch(context, onBusMessage, this);
+        m_pipeline.setSyncHandler(onSyncMessage, this);
+
+        m_loss_source = g_timeout_source_new(std::max<guint>(m_config.loss_interval_ms, 100));
+        g_source_set_callback(m_loss_source, onLossTimer, this, NULL);
+        g_source_attach(m_loss_source, m_context);
+    }
+
+    /**
+    @brief stops the pipeline, cancels the reconnect and loss timers and releases the tee pad of an attached decode branch.
+    The pipeline is stopped before anything else, probes and callbacks on the streaming threads use the stream members,
+    EG the latency histogram, the setup state and the log. Must run on the thread driving the stream context
+    */
+    ~RtspStream()
+    {
+        // first, the streaming threads run probes with this as user data
+        m_pipeline.setPipelineState(GST_STATE_NULL);
+        finishSetup(false);
+        releasePad(m_pending_video);
+        releasePad(m_pending_audio);
+        if(m_reconnect_source != NULL)
+        {
+            g_source_destroy(m_reconnect_source);
+            g_source_unref(m_reconnect_source);
+        }
+        g_source_destroy(m_loss_source);
+        g_source_unref(m_loss_source);
+
+        std::lock_guard<std::mutex> lock(m_decode_mutex);
+        if(m_decode_tee_pad != NULL)
+        {
+            gst_element_release_request_pad(m_pipeline.getElementByName("videotee"), m_decode_tee_pad);
+            gst_object_unref(m_decode_tee_pad);
+        }
+    }
+
+    RtspStream(RtspStream&&) = delete;
+    RtspStream(const RtspStream&) = delete;
+    /**
+    @brief reports when the session set up by start, or by a reconnect admitted through the admission callback, delivers
+    its first data or fails. Called once per setup, from a streaming thread on success and from the stream context otherwise.
+    Set it before start
+    @param callback callback
+    */
+    void setSetupCallback(setup_callback callback)
+    {
+        m_on_setup = std::move(callback);
+    }
+    /**
+    @brief asks for a setup slot before every reconnect, so a fleet that lost its cameras doesn't redo DESCRIBE/SETUP all at once.
+    Called on the stream context. Returning false queues the reconnect until admitReconnect is called. Set it before start
+    @param callback returns true if the reconnect may go ahead now
+    */
+    void setAdmissionCallback(admission_callback callback)
+    {
+        m_on_admission = std::move(callback);
+    }
+    /**
+    @brief hands a queued reconnect its setup slot. Must run on the thread driving the stream context.
+    A stream stopped meanwhile gives the slot straight back
+    */
+    void admitReconnect()
+    {
+        m_reconnect_queued = false;
+        if(!m_running.load())
+        {
+            m_setup_pending.store(true);
+            finishSetup(false);
+            return;
+        }
+        reconnectAdmitted();
+    }
+    /**
+    @returns every element factory a stream may be built from, decoders included
+    */
+    static std::vector<std::string> elementFactories()
+    {
+        std::vector<std::string> factories = {"rtspsrc", "tee", "queue", "appsink", "autovideosink", "capsfilter", "videocrop",
+                                              "videoscale", "videorate", "videoconvert", "filesink", "splitmuxsink", "mp4mux", "mpegtsmux", "matroskamux",
+                                              "cudaupload", "cudascale", "cudaconvert"};
+        for(const VideoCodec codec : videoCodecs())
+        {
+            const CodecElements& codec_elements = codecElements(codec);
+            factories.insert(factories.end(), {codec_elements.depay, codec_elements.parse, codec_elements.segment_muxer});
+            factories.insert(factories.end(), codec_elements.decoders.begin(), codec_elements.decoders.end());
+        }
+        factories.push_back("audioconvert");
+        for(const AudioCodec codec : audioCodecs())
+        {
+            const AudioCodecElements& codec_elements = audioCodecElements(codec);
+            factories.push_back(codec_elements.depay);
+            if(codec_elements.parse != NULL)
+                factories.push_back(codec_elements.parse);
+            factories.insert(factories.end(), codec_elements.decoders.begin(), codec_elements.decoders.end());
+        }
+        std::sort(factories.begin(), factories.end());
+        factories.erase(std::unique(factories.begin(), factories.end()), factories.end());
+        return factories;
+    }
+    /**
+    @brief starts playing the stream
+    @param on_playing called from the stream context once the pipeline reached PLAYING, or failed to. can be empty
+    @returns if the state was set
+    */
+    bool start(state_callback on_playing = state_callback())
+    {
+        m_running.store(true);
+        m_standby.store(false);
+        m_setup_pending.store(true);
+        if(changeState(GST_STATE_PLAYING, std::move(on_playing)))
+            return true;
+        m_setup_pending.store(false);
+        return false;
+    }
+    /**
+    @brief See start
+    @returns future holding true once the pipeline is PLAYING
+    */
+    std::future<bool> startFuture()
+    {
+        std::shared_ptr<std::promise<bool>> promise = std::make_shared<std::promise<bool>>();
+        std::future<bool> future = promise->get_future();
+        start([promise](bool reached){ promise->set_value(reached); });
+        return future;
+    }
+    /**
+    @brief pauses a playing stream. The rtsp session and the negotiated pipeline are kept, so resume skips
+    the DESCRIBE/SETUP round trips and caps negotiation a cold start pays for. The server stops sending while paused
+    @param on_paused called from the stream context once the pipeline reached PAUSED, or failed to. can be empty
+    @returns false if the state change failed right away
+    */
+    bool standby(state_callback on_paused = state_callback())
+    {
+        if(!m_running.load())
+            return false;
+        m_standby.store(true);
+        return changeState(GST_STATE_PAUSED, std::move(on_paused));
+    }
+    /**
+    @brief resumes a stream in standby and asks upstream for a keyframe, so the first frame doesn't wait for the next GOP
+    @param on_playing called from the stream context once the pipeline reached PLAYING, or failed to. can be empty
+    @returns false if the stream is not in standby or the state change failed right away
+    */
+    bool resume(state_callback on_playing = state_callback())
+    {
+        if(!m_standby.exchange(false))
+            return false;
+        if(!changeState(GST_STATE_PLAYING, std::move(on_playing)))
+            return false;
+        if(!m_chain_built.load())
+            return true;
+
+        GstPad* parse_pad = gst_element_get_static_pad(m_pipeline.getElementByName("videoparse"), "src");
+        gst_pad_send_event(parse_pad, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+        gst_object_unref(parse_pad);
+        return true;
+    }
+    /**
+    @returns true if the stream was put in standby and not resumed yet
+    */
+    bool isStandby() const
+    {
+        return m_standby.load();
+    }
+    /**
+    @returns microseconds from the last start or resume until the pipeline reached PLAYING, -1 if it hasn't yet
+    */
+    gint64 timeToPlaying() const
+    {
+        return m_time_to_playing_us.load();
+    }
+    /**
+    @returns microseconds from the last start or resume until the first frame reached the sink, -1 if none has yet
+    */
+    gint64 timeToFirstFrame() const
+    {
+        return m_time_to_first_frame_us.load();
+    }
+    /**
+    @brief stops the stream and releases the rtsp session
+    @returns if the state was set
+    */
+    bool stop()
+    {
+        m_running.store(false);
+        m_standby.store(false);
+        finishSetup(false);
+        return m_pipeline.setPipelineState(GST_STATE_NULL);
+    }
+    /**
+    @brief registers a decode consumer. With lazy_decode the first subscriber attaches the decode branch,
+    which starts decoding at the next keyframe. Never call it from a frame callback
+    @returns true if the decode branch is attached
+    */
+    bool subscribeDecode()
+    {
+        std::lock_guard<std::mutex> lock(m_decode_mutex);
+        if(!m_config.decode)
+            return false;
+        if(!m_config.lazy_decode)
+            return true;
+        // the branch doesn't exist before the codec is detected, buildChain attaches it
+        if(!m_chain_built.load())
+        {
+            m_decode_subscribers++;
+            return true;
+        }
+
+        if(m_decode_subscribers++ == 0 && !attachDecodeBranch())
+        {
+            m_decode_subscribers = 0;
+            detachDecodeBranch();
+            return false;
+        }
+        return true;
+    }
+    /**
+    @brief releases a decode consumer. With lazy_decode the last one detaches the decode branch and sets it to NULL.
+    Never call it from a frame callback, stopping the branch joins the thread the callback runs on
+    */
+    void unsubscribeDecode()
+    {
+        std::lock_guard<std::mutex> lock(m_decode_mutex);
+        if(!m_config.lazy_decode || m_decode_subscribers == 0)
+            return;
+
+        if(--m_decode_subscribers == 0 && m_chain_built.load())
+            detachDecodeBranch();
+    }
+    /**
+    @brief changes resolution, framerate and pixel format of the decoded frames while the stream plays. The capsfilter
+    in front of the sink gets the new caps and the conversions renegotiate from the next frame, the rtsp session and the
+    decoder are untouched. Needs StreamConfig::reconfigurable. A shared memory ring keeps its slot size, larger frames are dropped there
+    @param output new output. Zero and empty fields keep what the decoder produces
+    @returns false if the stream isn't reconfigurable or the caps are invalid
+    */
+    bool reconfigure(const OutputFormat& output)
+    {
+        if(!m_config.reconfigurable || !m_config.decode)
+        {
+            std::cout << m_name << ": the stream wasn't built reconfigurable\n";
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_output_mutex);
+        // an auto detected stream builds the capsfilter later and applies m_output then
+        if(m_chain_built.load() && !applyOutput(output))
+            return false;
+        m_output = output;
+        return true;
+    }
+    /**
+    @returns the output the decode branch currently asks for
+    */
+    OutputFormat outputFormat() const
+    {
+        std::lock_guard<std::mutex> lock(m_output_mutex);
+        return m_output;
+    }
+    /**
+    @brief changes decimation while the stream is running
+    @param target_fps drop frames before the decoder down to this rate, 0 decodes every frame
+    @param keyframes_only only decode keyframes
+    */
+    void setDecimation(const double target_fps, const bool keyframes_only)
+    {
+        std::lock_guard<std::mutex> lock(m_throttle_mutex);
+        m_target_fps = target_fps;
+        m_keyframes_only = keyframes_only;
+        // a throttled stream keeps decoding keyframes only until the throttle is lifted
+        if(m_throttle >= StreamThrottle::DECIMATE)
+            return;
+        m_decimator.setTargetFps(target_fps);
+        m_decimator.setKeyframesOnly(keyframes_only);
+    }
+    /**
+    @brief holds the stream back to save memory or lifts the throttle, see StreamThrottle. The StreamManager memory budget drives it.
+    Every level in between is applied or lifted on the way
+    @param level new level
+    @returns false if the stream isn't running
+    */
+    bool throttle(const StreamThrottle level)
+    {
+        if(!m_running.load())
+            return false;
+
+        bool pause = false;
+        bool resume_stream = false;
+        {
+            std::lock_guard<std::mutex> lock(m_throttle_mutex);
+            const StreamThrottle from = m_throttle;
+            if(level == from)
+                return true;
+            m_throttle = level;
+
+            if((from >= StreamThrottle::QUEUES) != (level >= StreamThrottle::QUEUES))
+            {
+                QueueLimits limits = queueLimits(level >= StreamThrottle::QUEUES);
+                m_pipeline.forEachElement(applyQueueLimits, &limits);
+            }
+            if((from >= StreamThrottle::DECIMATE) != (level >= StreamThrottle::DECIMATE))
+            {
+                const bool decimate = level >= StreamThrottle::DECIMATE;
+                m_decimator.setTargetFps(decimate ? 0.0 : m_target_fps);
+                m_decimator.setKeyframesOnly(decimate || m_keyframes_only);
+            }
+            // a stream already in standby is left to whoever put it there
+            pause = level == StreamThrottle::PAUSE && !m_standby.load();
+            resume_stream = from == StreamThrottle::PAUSE && m_throttle_paused;
+            m_throttle_paused = pause;
+        }
+
+        m_log.log(m_name, std::string("throttle ") + throttleName(level));
+        if(pause)
+            standby();
+        else if(resume_stream)
+            resume();
+        return true;
+    }
+    /**
+    @returns the current throttle level
+    */
+    StreamThrottle throttleLevel() const
+    {
+        std::lock_guard<std::mutex> lock(m_throttle_mutex);
+        return m_throttle;
+    }
+    /**
+    @brief measures what the stream holds right now. Safe from any thread. Decoder internal pools are not visible and not included
+    @returns See ResourceUsage
+    */
+    ResourceUsage resourceUsage()
+    {
+        ResourceUsage usage;
+        ElementUsage elements = ElementUsage();
+        m_pipeline.forEachElement(addElementUsage, &elements);
+        usage.jitterbuffer_bytes = elements.jitterbuffers;
+        usage.queue_bytes = elements.queues;
+
+        // the pools and the sink are only installed once the chain is built
+        if(m_chain_built.load())
+        {
+            usage.pool_bytes = m_pipeline.bufferPoolBytes();
+            if(m_config.frame_ring)
+                usage.ring_bytes = m_config.frame_ring->size() * frameBytes();
+        }
+        if(m_config.pre_event)
+            usage.pre_event_bytes = m_config.pre_event->stats().bytes;
+        usage.cpu_time = m_cpu.total();
+        return usage;
+    }
+    /**
+    @returns the priority the stream was configured with, see StreamConfig::priority
+    */
+    gint priority() const
+    {
+        return m_config.priority;
+    }
+    /**
+    @returns decimation counters
+    */
+    DecimationStats decimationStats() const
+    {
+        return m_decimator.stats();
+    }
+    /**
+    @returns codec of the audio track, NONE while no audio is received
+    */
+    AudioCodec audioCodec() const
+    {
+        return m_audio_codec.load();
+    }
+    /**
+    @returns codec of the stream, AUTO until it is detected from the first video pad
+    */
+    VideoCodec videoCodec() const
+    {
+        return m_codec.load();
+    }
+    /**
+    @returns number of reconnect attempts made so far
+    */
+    guint64 reconnectCount() const
+    {
+        return m_reconnects.load(std::memory_order_relaxed);
+    }
+    /**
+    @returns packet counters and the current transport
+    */
+    TransportStats transportStats() const
+    {
+        TransportStats stats;
+        stats.transport = m_transport.load();
+        stats.packets = m_packets.load(std::memory_order_relaxed);
+        stats.lost = m_lost.load(std::memory_order_relaxed);
+        stats.late = m_late.load(std::memory_order_relaxed);
+        stats.switches = m_transport_switches.load(std::memory_order_relaxed);
+        stats.loss_ratio = m_loss_ratio.load(std::memory_order_relaxed);
+        return stats;
+    }
+    /**
+    @brief time from capture on the camera to the frame reaching the sink. Only recorded with measure_latency.
+    Capture times come from the rtcp sender reports, so the numbers are only meaningful when the camera and this
+    host are both synced to NTP. Until the first sender report arrives arrival times are used instead
+    @returns See above
+    */
+    const LatencyHistogram& glassToGlass() const
+    {
+        return m_glass_to_glass;
+    }
+    /**
+    @returns true if decoded frames are currently being produced
+    */
+    bool isDecoding()
+    {
+        std::lock_guard<std::mutex> lock(m_decode_mutex);
+        return m_config.decode && (!m_config.lazy_decode || m_decode_tee_pad != NULL);
+    }
+    /**
+    @returns the stream name
+    */
+    const std::string& name() const
+    {
+        return m_name;
+    }
+    /**
+    @returns the decoder plugin the stream was built with, empty if the build failed
+    */
+    const std::string& decoderName() const
+    {
+        return m_decoder;
+    }
+    /**
+    @returns true if decoded frames are delivered in CUDA memory, false if gpu_memory was off or the cuda elements are missing
+    */
+    bool isDeviceMemory() const
+    {
+        return m_device;
+    }
+    /**
+    @returns the underlying pipeline
+    */
+    GStreamPipeline& pipeline()
+    {
+        return m_pipeline;
+    }
+};
+
+
+#endif // RTSP_STREAM_H
@@ -0,0 +1,413 @@
+#ifndef SHARED_FRAME_RING_H
+#define SHARED_FRAME_RING_H
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "VideoFrame.h"
+
+
+/*
+Layout of the shared memory object, every field in host byte order:
+
+    offset 0               SharedRingHeader, 64 bytes
+    offset 64 + i * slot   slot i, slot_stride bytes each
+        +0                 SharedSlotHeader, 128 bytes
+        +128               plane data. Plane p starts at plane_offset[p] from the slot data, rows are plane_stride[p] bytes apart
+
+Frame n is written to slot n % slot_count. Each slot is guarded by a seqlock: the writer makes sequence odd, writes the
+header and the planes, then stores 2 * (n + 1). A reader loads sequence, reads in place and loads sequence again, the read
+is valid if both loads returned the same even value. Readers never write to the mapping, so any number of them can
+attach, and a reader that falls behind loses frames instead of slowing the writer down.
+*/
+
+static const uint32_t SHARED_RING_MAGIC = 0x46535452;   // "RTSF"
+static const uint32_t SHARED_RING_VERSION = 1;
+static const uint32_t SHARED_RING_MAX_PLANES = 4;
+
+
+/**
+@brief header at the start of the shared memory object
+*/
+struct alignas(64) SharedRingHeader
+{
+    uint32_t              magic;          // SHARED_RING_MAGIC once the writer finished initializing
+    uint32_t              version;        // SHARED_RING_VERSION
+    uint32_t              slot_count;
+    uint32_t              slot_stride;    // bytes from one slot to the next, slot header included
+    uint32_t              slot_capacity;  // plane bytes a slot holds
+    uint32_t              reserved;
+    std::atomic<uint64_t> frames;         // frames published so far. The newest one is frames - 1
+};
+
+
+/**
+@brief header of one slot. Every field except sequence is only valid inside a successful seqlock read
+*/
+struct alignas(64) SharedSlotHeader
+{
+    std::atomic<uint64_t> sequence;       // odd while the writer is inside the slot
+    uint64_t              frame;          // frame number
+    int64_t               pts;            // presentation timestamp in nanoseconds, -1 if unknown
+    int64_t               published_us;   // CLOCK_MONOTONIC of the writer when the frame was published
+    uint32_t              width;
+    uint32_t              height;
+    uint32_t              format;         // GstVideoFormat
+    uint32_t              planes;
+    uint32_t              plane_offset[SHARED_RING_MAX_PLANES];
+    int32_t               plane_stride[SHARED_RING_MAX_PLANES];
+    uint32_t              size;           // plane bytes used
+};
+
+
+static_assert(sizeof(SharedRingHeader) == 64, "shared ring header layout changed");
+static_assert(sizeof(SharedSlotHeader) == 128, "shared slot header layout changed");
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the seqlock needs address free 64 bit atomics");
+
+
+
+
+/**
+@brief publishes decoded frames into a POSIX shared memory ring, see the layout above. Single writer
+*/
+class SharedFrameWriter
+{
+private:
+    const std::string    m_name;
+    const uint32_t       m_slot_count;
+    int                  m_fd;
+    uint8_t*             m_map;
+    size_t               m_map_size;
+    uint32_t             m_slot_capacity;
+    uint64_t             m_next_frame;
+    std::atomic<guint64> m_oversized;   // frames dropped because they didn't fit a slot
+
+    /**
+    @returns the ring header in the mapping
+    */
+    SharedRingHeader* header() const
+    {
+        return reinterpret_cast<SharedRingHeader*>(m_map);
+    }
+    /**
+    @param frame frame number
+    @returns the slot the frame is written to
+    */
+    SharedSlotHeader* slot(const uint64_t frame) const
+    {
+        return reinterpret_cast<SharedSlotHeader*>(m_map + sizeof(SharedRingHeader) + (frame % m_slot_count) * header()->slot_stride);
+    }
+    /**
+    @brief creates and maps the object for slots of the given size
+    @param capacity plane bytes per slot
+    @returns true on success false on failure
+    */
+    bool create(const size_t capacity)
+    {
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const size_t slot_stride = (sizeof(SharedSlotHeader) + capacity + page - 1) / page * page;
+        const size_t size = sizeof(SharedRingHeader) + slot_stride * m_slot_count;
+
+        shm_unlink(m_name.c_str());
+        m_fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if(m_fd < 0 || ftruncate(m_fd, static_cast<off_t>(size)) != 0)
+        {
+            std::cout << "Failed to create shared memory " << m_name << ": " << std::strerror(errno) << '\n';
+            return false;
+        }
+        void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if(map == MAP_FAILED)
+        {
+            std::cout << "Failed to map shared memory " << m_name << ": " << std::strerror(errno) << '\n';
+            return false;
+        }
+        m_map = static_cast<uint8_t*>(map);
+        m_map_size = size;
+        m_slot_capacity = static_cast<uint32_t>(slot_stride - sizeof(SharedSlotHeader));
+
+        // ftruncate zero filled the object, so every slot sequence starts at 0
+        SharedRingHeader* ring = header();
+        ring->version = SHARED_RING_VERSION;
+        ring->slot_count = m_slot_count;
+        ring->slot_stride = static_cast<uint32_t>(slot_stride);
+        ring->slot_capacity = m_slot_capacity;
+        ring->frames.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        ring->magic = SHARED_RING_MAGIC;
+        return true;
+    }
+
+public:
+    /**
+    @brief the object is created when the first frame arrives, with slots sized for that frame
+    @param name shm object name, EG /camera0
+    @param slot_count frames kept in the ring
+    */
+    SharedFrameWriter(const std::string& name, const uint32_t slot_count)
+        : m_name(name), m_slot_count(std::max<uint32_t>(slot_count, 2)), m_fd(-1), m_map(NULL), m_map_size(0), m_slot_capacity(0),
+          m_next_frame(0), m_oversized(0)
+    {}
+    /**
+    @brief unmaps and unlinks the object. Readers that still have it mapped keep their mapping
+    */
+    ~SharedFrameWriter()
+    {
+        if(m_map != NULL)
+            munmap(m_map, m_map_size);
+        if(m_fd >= 0)
+        {
+            close(m_fd);
+            shm_unlink(m_name.c_str());
+        }
+    }
+
+    SharedFrameWriter(SharedFrameWriter&&) = delete;
+    SharedFrameWriter(const SharedFrameWriter&) = delete;
+    /**
+    @brief copies a frame into the next slot. Only one thread may publish
+    @param frame mapped host memory frame
+    @returns false if the frame could not be published
+    */
+    bool publish(const VideoFrame& frame)
+    {
+        if(G_UNLIKELY(!frame.isMapped() || frame.isDevice() || frame.planes() > SHARED_RING_MAX_PLANES))
+            return false;
+
+        size_t size = 0;
+        for(guint plane = 0; plane < frame.planes(); plane++)
+            size += static_cast<size_t>(frame.planeStride(plane)) * frame.planeHeight(plane);
+
+        if(G_UNLIKELY(m_map == NULL))
+        {
+            // leave room for a larger frame after renegotiation
+            if(m_fd >= 0 || !create(size + size / 4))
+                return false;
+        }
+        if(G_UNLIKELY(size > m_slot_capacity))
+        {
+            m_oversized.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        const uint64_t number = m_next_frame++;
+        SharedSlotHeader* target = slot(number);
+        target->sequence.store(2 * number + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        target->frame = number;
+        target->pts = GST_CLOCK_TIME_IS_VALID(frame.pts()) ? static_cast<int64_t>(frame.pts()) : -1;
+        target->published_us = g_get_monotonic_time();
+        target->width = frame.width();
+        target->height = frame.height();
+        target->format = frame.format();
+        target->planes = frame.planes();
+        target->size = static_cast<uint32_t>(size);
+
+        uint8_t* data = reinterpret_cast<uint8_t*>(target) + sizeof(SharedSlotHeader);
+        uint32_t offset = 0;
+        for(guint plane = 0; plane < frame.planes(); plane++)
+        {
+            const size_t plane_size = static_cast<size_t>(frame.planeStride(plane)) * frame.planeHeight(plane);
+            target->plane_offset[plane] = offset;
+            target->plane_stride[plane] = frame.planeStride(plane);
+            std::memcpy(data + offset, frame.planeData(plane), plane_size);
+            offset += static_cast<uint32_t>(plane_size);
+        }
+
+        target->sequence.store(2 * number + 2, std::memory_order_release);
+        header()->frames.store(number + 1, std::memory_order_release);
+        return true;
+    }
+    /**
+    @returns the shm object name
+    */
+    const std::string& name() const
+    {
+        return m_name;
+    }
+    /**
+    @returns number of frames published
+    */
+    uint64_t published() const
+    {
+        return m_next_frame;
+    }
+    /**
+    @returns number of frames dropped because they were larger than a slot
+    */
+    guint64 oversized() const
+    {
+        return m_oversized.load(std::memory_order_relaxed);
+    }
+};
+
+
+
+
+/**
+@brief a frame read in place from a SharedFrameReader. The pointers stay inside the mapping, nothing is copied.
+The data is only known to be intact if SharedFrameReader::validate returns true after the consumer is done with it
+*/
+struct SharedFrameView
+{
+    SharedSlotHeader        header;     // copy of the slot header, sequence holds the value the read started at
+    const uint8_t*          data;       // start of the plane data in the mapping
+    const SharedSlotHeader* slot;
+
+    SharedFrameView()
+        : header(), data(NULL), slot(NULL)
+    {}
+    /**
+    @param plane plane index. Must be less than header.planes
+    @returns pointer to the first byte of the plane
+    */
+    const uint8_t* planeData(const uint32_t plane) const
+    {
+        return data + header.plane_offset[plane];
+    }
+};
+
+
+
+
+/**
+@brief maps a ring published by a SharedFrameWriter read only. Any number of readers, in any process
+*/
+class SharedFrameReader
+{
+private:
+    int            m_fd;
+    const uint8_t* m_map;
+    size_t         m_map_size;
+
+    /**
+    @returns the ring header in the mapping
+    */
+    const SharedRingHeader* header() const
+    {
+        return reinterpret_cast<const SharedRingHeader*>(m_map);
+    }
+
+public:
+    SharedFrameReader()
+        : m_fd(-1), m_map(NULL), m_map_size(0)
+    {}
+    ~SharedFrameReader()
+    {
+        close();
+    }
+
+    SharedFrameReader(SharedFrameReader&&) = delete;
+    SharedFrameReader(const SharedFrameReader&) = delete;
+    /**
+    @brief maps the ring
+    @param name shm object name the writer was created with
+    @returns false if it doesn't exist yet or isn't a frame ring. Retry later, the writer creates it on its first frame
+    */
+    bool open(const std::string& name)
+    {
+        close();
+        m_fd = shm_open(name.c_str(), O_RDONLY, 0);
+        struct stat info;
+        if(m_fd < 0 || fstat(m_fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(SharedRingHeader))
+        {
+            close();
+            return false;
+        }
+
+        void* map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+        if(map == MAP_FAILED)
+        {
+            close();
+            return false;
+        }
+        m_map = static_cast<const uint8_t*>(map);
+        m_map_size = info.st_size;
+
+        const SharedRingHeader* ring = header();
+        const bool valid = ring->magic == SHARED_RING_MAGIC && ring->version == SHARED_RING_VERSION &&
+                           sizeof(SharedRingHeader) + static_cast<size_t>(ring->slot_stride) * ring->slot_count <= m_map_size;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(!valid)
+            close();
+        return valid;
+    }
+    /**
+    @brief unmaps the ring
+    */
+    void close()
+    {
+        if(m_map != NULL)
+            munmap(const_cast<uint8_t*>(m_map), m_map_size);
+        if(m_fd >= 0)
+            ::close(m_fd);
+        m_map = NULL;
+        m_map_size = 0;
+        m_fd = -1;
+    }
+    /**
+    @returns number of frames the writer published, 0 if not open
+    */
+    uint64_t frames() const
+    {
+        return m_map != NULL ? header()->frames.load(std::memory_order_acquire) : 0;
+    }
+    /**
+    @brief starts reading a frame in place
+    @param frame frame number, EG frames() - 1 for the newest
+    @param view receives the frame
+    @returns false if the frame was overwritten or is being written
+    */
+    bool read(const uint64_t frame, SharedFrameView& view) const
+    {
+        if(m_map == NULL)
+            return false;
+
+        const SharedRingHeader* ring = header();
+        const SharedSlotHeader* slot = reinterpret_cast<const SharedSlotHeader*>(m_map + sizeof(SharedRingHeader) + (frame % ring->slot_count) * ring->slot_stride);
+        const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if(sequence != 2 * frame + 2)
+            return false;
+
+        view.header.sequence.store(sequence, std::memory_order_relaxed);
+        view.header.frame = slot->frame;
+        view.header.pts = slot->pts;
+        view.header.published_us = slot->published_us;
+        view.header.width = slot->width;
+        view.header.height = slot->height;
+        view.header.format = slot->format;
+        view.header.planes = slot->planes;
+        std::copy(slot->plane_offset, slot->plane_offset + SHARED_RING_MAX_PLANES, view.header.plane_offset);
+        std::copy(slot->plane_stride, slot->plane_stride + SHARED_RING_MAX_PLANES, view.header.plane_stride);
+        view.header.size = slot->size;
+        view.data = reinterpret_cast<const uint8_t*>(slot) + sizeof(SharedSlotHeader);
+        view.slot = slot;
+        // the header copy must not be torn either
+        return validate(view) && view.header.planes <= SHARED_RING_MAX_PLANES && view.header.size <= ring->slot_capacity;
+    }
+    /**
+    @brief See read
+    @param view view returned by read
+    @returns true if the writer hasn't touched the slot since read began, so everything read from the view is intact
+    */
+    bool validate(const SharedFrameView& view) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return view.slot != NULL && view.slot->sequence.load(std::memory_order_relaxed) == view.header.sequence.load(std::memory_order_relaxed);
+    }
+};
+
+
+#endif // SHARED_FRAME_RING_H
@@ -0,0 +1,275 @@
+#ifndef STREAM_EVENTS_H
+#define STREAM_EVENTS_H
+
+#include <gst/gst.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+
+
+
+
+/**
+@brief kind of a StreamEvent, one per bus message type that is forwarded
+*/
+enum class StreamEventType
+{
+    ERROR,
+    WARNING,
+    QOS,            // a sink dropped or was late rendering buffers
+    EOS,
+    STREAM_START,
+    LATENCY,        // an element changed its latency, the pipeline latency was recalculated
+    BUFFERING
+};
+
+
+/**
+@param type event type
+@returns the type name used in logs
+*/
+inline const char* eventTypeName(const StreamEventType type)
+{
+    switch(type)
+    {
+        case StreamEventType::ERROR:
+            return "error";
+        case StreamEventType::WARNING:
+            return "warning";
+        case StreamEventType::QOS:
+            return "qos";
+        case StreamEventType::EOS:
+            return "eos";
+        case StreamEventType::STREAM_START:
+            return "stream-start";
+        case StreamEventType::LATENCY:
+            return "latency";
+        case StreamEventType::BUFFERING:
+            return "buffering";
+    }
+    return "unknown";
+}
+
+
+/**
+@brief a bus message of a stream, copied out of the message so it outlives it
+*/
+struct StreamEvent
+{
+    StreamEventType type;
+    std::string     stream;     // id of the stream
+    std::string     source;     // name of the element that posted the message
+    std::string     text;       // error or warning text, empty otherwise
+    gint            percent;    // buffering level, 0 otherwise
+    guint64         processed;  // buffers the sink rendered, QOS only
+    guint64         dropped;    // buffers the sink dropped, QOS only
+    gint64          time_us;    // g_get_monotonic_time when the message was handled
+};
+
+
+
+
+/**
+@brief bounded lock free MPMC queue of StreamEvents, the same sequence-numbered design as FrameRing.
+Producers never block, when the queue is full the new event is dropped and counted
+*/
+class EventQueue
+{
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        StreamEvent*        event;
+    };
+
+    const size_t            m_mask;
+    std::unique_ptr<Cell[]> m_cells;
+
+    char                    m_pad0[64];
+    std::atomic<size_t>     m_enqueue_pos;
+    char                    m_pad1[64];
+    std::atomic<size_t>     m_dequeue_pos;
+    char                    m_pad2[64];
+
+    std::atomic<guint64>    m_dropped;
+
+    /**
+    @brief rounds up to the next power of two
+    @param value value to round. 0 and 1 give 2
+    @returns See above
+    */
+    static size_t roundCapacity(size_t value)
+    {
+        size_t capacity = 2;
+        while(capacity < value)
+            capacity <<= 1;
+        return capacity;
+    }
+
+public:
+    /**
+    @param capacity number of events the queue holds. Rounded up to a power of two
+    */
+    explicit EventQueue(const size_t capacity = 1024)
+        : m_mask(roundCapacity(capacity) - 1), m_cells(new Cell[m_mask + 1]),
+          m_pad0(), m_enqueue_pos(0), m_pad1(), m_dequeue_pos(0), m_pad2(), m_dropped(0)
+    {
+        for(size_t i = 0; i <= m_mask; i++)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+            m_cells[i].event = NULL;
+        }
+    }
+    /**
+    @brief releases every event still queued
+    */
+    ~EventQueue()
+    {
+        StreamEvent event;
+        while(tryPop(event))
+            ;
+    }
+
+    EventQueue(EventQueue&&) = delete;
+    EventQueue(const EventQueue&) = delete;
+    /**
+    @brief queues an event. Never blocks
+    @param event event to queue
+    @returns false if the queue was full and the event dropped
+    */
+    bool push(StreamEvent&& event)
+    {
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+        for(;;)
+        {
+            cell = &m_cells[pos & m_mask];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if(diff == 0)
+            {
+                if(m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(diff < 0)
+            {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            else
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        }
+        cell->event = new StreamEvent(std::move(event));
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+    /**
+    @brief takes the oldest queued event. Never blocks
+    @param event receives the event
+    @returns false if the queue was empty
+    */
+    bool tryPop(StreamEvent& event)
+    {
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        Cell* cell;
+        for(;;)
+        {
+            cell = &m_cells[pos & m_mask];
+            const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if(diff == 0)
+            {
+                if(m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(diff < 0)
+                return false;
+            else
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+        StreamEvent* queued = cell->event;
+        cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        event = std::move(*queued);
+        delete queued;
+        return true;
+    }
+    /**
+    @returns number of events dropped because the queue was full
+    */
+    guint64 dropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+};
+
+
+typedef std::shared_ptr<EventQueue> EventQueuePtr;
+
+
+
+
+/**
+@brief token bucket limiting how often a stream writes to the console. Messages over the limit are counted,
+and the count is reported with the next message that gets through
+*/
+class LogLimiter
+{
+private:
+    const double m_rate;        // messages per second
+    const double m_burst;       // messages allowed back to back
+    std::mutex   m_mutex;
+    double       m_tokens;
+    gint64       m_last_us;
+    guint64      m_suppressed;
+
+public:
+    /**
+    @param rate messages per second once the burst is spent
+    @param burst messages allowed back to back
+    */
+    explicit LogLimiter(const double rate = 1.0, const double burst = 5.0)
+        : m_rate(rate), m_burst(burst), m_mutex(), m_tokens(burst), m_last_us(0), m_suppressed(0)
+    {}
+
+    LogLimiter(LogLimiter&&) = delete;
+    LogLimiter(const LogLimiter&) = delete;
+    /**
+    @brief writes a line to std::cout if the limit allows it
+    @param prefix line prefix, EG the stream name
+    @param text line text
+    @returns true if the line was written
+    */
+    bool log(const std::string& prefix, const std::string& text)
+    {
+        guint64 suppressed;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            const gint64 now = g_get_monotonic_time();
+            if(m_last_us != 0)
+                m_tokens = std::min(m_burst, m_tokens + (now - m_last_us) * m_rate / 1e6);
+            m_last_us = now;
+            if(m_tokens < 1.0)
+            {
+                m_suppressed++;
+                return false;
+            }
+            m_tokens -= 1.0;
+            suppressed = m_suppressed;
+            m_suppressed = 0;
+        }
+
+        if(suppressed != 0)
+            std::cout << prefix << ": " << text << " (" << suppressed << " messages suppressed)\n";
+        else
+            std::cout << prefix << ": " << text << '\n';
+        return true;
+    }
+};
+
+
+#endif // STREAM_EVENTS_H
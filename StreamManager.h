@@ -0,0 +1,939 @@
+#ifndef STREAM_MANAGER_H
+#define STREAM_MANAGER_H
+
+#include <gst/gst.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <string>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "FactoryCache.h"
+#include "FrameBatcher.h"
+#include "FrameSync.h"
+#include "ResourceUsage.h"
+#include "RtspStream.h"
+
+
+
+
+/**
+@brief memory the streams of a StreamManager may hold together, see StreamManager::setMemoryBudget
+*/
+struct MemoryBudget
+{
+    gsize  max_bytes;       // sum of ResourceUsage::memory over every stream. 0 lifts every throttle and only accounts
+    guint  interval_ms;     // time between two checks. A check throttles or releases one stream by one level
+    double release_ratio;   // throttles are lifted once usage falls below max_bytes times this
+
+    MemoryBudget()
+        : max_bytes(0), interval_ms(1000), release_ratio(0.8)
+    {}
+};
+
+
+
+
+/**
+@brief runs many RtspStreams inside one process.
+Every stream is assigned to one of a fixed number of worker threads, each running a GMainLoop on its own GMainContext.
+Bus messages for a stream are always dispatched on the worker it was assigned to
+*/
+class StreamManager
+{
+private:
+    struct Worker
+    {
+        GMainContext* context;
+        GMainLoop*    loop;
+        std::thread   thread;
+        size_t        stream_count;
+    };
+    typedef std::pair<RtspStream*, Worker*> stream_entry;
+    typedef std::map<std::string, stream_entry> stream_map;
+    /**
+    @brief a first start or a reconnect waiting for a setup slot
+    */
+    struct QueuedSetup
+    {
+        RtspStream* stream;
+        Worker*     worker;
+        bool        reconnect;
+    };
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    stream_map m_streams;
+    std::mutex m_mutex;
+    std::map<std::string, FrameBatcherPtr> m_batched;  // streams feeding a batcher, by stream id
+    std::map<std::string, FrameSynchronizerPtr> m_synced;  // streams feeding a synchronizer, by stream id
+    EventQueuePtr m_events;     // bus events of every stream that doesn't have its own queue
+
+    // memory budget, checked from a timer on the first worker. Guarded by m_mutex
+    MemoryBudget m_budget;
+    GSource*     m_budget_source;
+    std::map<std::string, StreamThrottle> m_throttles;     // level asked of every throttled stream, by stream id
+    guint64      m_throttle_steps;
+    guint64      m_release_steps;
+
+    // admission of rtsp session setups. Separate from m_mutex, setups finish on streaming threads while m_mutex is held
+    std::mutex m_setup_mutex;
+    std::deque<QueuedSetup> m_setup_queue;  // streams waiting for a setup slot
+    size_t     m_setups_in_flight;
+    size_t     m_max_setups;
+    bool       m_stopping;
+
+    /**
+    @brief a queued start handed to the worker of the stream
+    */
+    struct QueuedStart
+    {
+        StreamManager* manager;
+        RtspStream*    stream;
+    };
+
+    /**
+    @brief a stream handed to its worker for destruction, with the consumers its callbacks feed.
+    They are released after the stream, so a frame delivered until then never reaches a freed consumer
+    */
+    struct QueuedDestroy
+    {
+        RtspStream*          stream;
+        FrameBatcherPtr      batcher;
+        FrameSynchronizerPtr synchronizer;
+    };
+
+    /**
+    @brief a throttle change handed to the worker of the stream
+    */
+    struct QueuedThrottle
+    {
+        RtspStream*    stream;
+        StreamThrottle level;
+    };
+
+    /**
+    @brief worker thread body
+    @param worker worker to run
+    */
+    static void runWorker(Worker* worker)
+    {
+        g_main_context_push_thread_default(worker->context);
+        g_main_loop_run(worker->loop);
+        g_main_context_pop_thread_default(worker->context);
+    }
+    /**
+    @brief quits a worker loop from inside the loop, so a quit issued before the loop started running is not lost
+    @param user_data GMainLoop to quit
+    @returns G_SOURCE_REMOVE
+    */
+    static gboolean quitWorker(gpointer user_data)
+    {
+        g_main_loop_quit(static_cast<GMainLoop*>(user_data));
+        return G_SOURCE_REMOVE;
+    }
+    /**
+    @brief schedules a callback on a worker context
+    @param worker worker to run on
+    @param callback callback to invoke once
+    @param user_data user data. can be NULL
+    */
+    static void invokeOnWorker(Worker* worker, GSourceFunc callback, gpointer user_data)
+    {
+        GSource* source = g_idle_source_new();
+        g_source_set_callback(source, callback, user_data, NULL);
+        g_source_attach(source, worker->context);
+        g_source_unref(source);
+    }
+    /**
+    @brief destroys a stream on the thread running its context so it never races its own bus callbacks
+    @param user_data QueuedDestroy
+    @returns G_SOURCE_REMOVE
+    */
+    static gboolean destroyStream(gpointer user_data)
+    {
+        QueuedDestroy* queued = static_cast<QueuedDestroy*>(user_data);
+        delete queued->stream;
+        delete queued;
+        return G_SOURCE_REMOVE;
+    }
+    /**
+    @brief starts a stream now if a setup slot is free, otherwise queues it until one is released
+    @param stream stream to start. Must not be started yet
+    @param worker worker of the stream
+    @returns false if the stream was started right away and failed
+    */
+    bool requestStart(RtspStream* stream, Worker* worker)
+    {
+        stream->setSetupCallback([this](bool){ releaseSetup(); });
+        stream->setAdmissionCallback([this, stream, worker](){ return admitSetup(stream, worker); });
+        {
+            std::lock_guard<std::mutex> lock(m_setup_mutex);
+            if(m_max_setups != 0 && m_setups_in_flight >= m_max_setups)
+            {
+                m_setup_queue.push_back({stream, worker, false});
+                return true;
+            }
+            m_setups_in_flight++;
+        }
+
+        if(stream->start())
+            return true;
+        releaseSetup();
+        return false;
+    }
+    /**
+    @brief admission callback of a stream about to reconnect. Takes a setup slot if one is free, otherwise queues the reconnect
+    @param stream stream reconnecting
+    @param worker worker of the stream
+    @returns true if the stream may reconnect now
+    */
+    bool admitSetup(RtspStream* stream, Worker* worker)
+    {
+        std::lock_guard<std::mutex> lock(m_setup_mutex);
+        if(m_stopping)
+            return false;
+        if(m_max_setups != 0 && m_setups_in_flight >= m_max_setups)
+        {
+            m_setup_queue.push_back({stream, worker, true});
+            return false;
+        }
+        m_setups_in_flight++;
+        return true;
+    }
+    /**
+    @brief frees a setup slot and hands it to the next queued stream. The stream is started or reconnected on its own worker
+    */
+    void releaseSetup()
+    {
+        std::lock_guard<std::mutex> lock(m_setup_mutex);
+        if(m_stopping)
+            return;
+        m_setups_in_flight--;
+        if(m_setup_queue.empty())
+            return;
+        const QueuedSetup next = m_setup_queue.front();
+        m_setup_queue.pop_front();
+        m_setups_in_flight++;
+        // posted under the lock: removeStream takes it before posting destroyStream, so the worker runs this first
+        invokeOnWorker(next.worker, next.reconnect ? reconnectQueued : startQueued, new QueuedStart{this, next.stream});
+    }
+    /**
+    @brief starts a stream that waited for a setup slot
+    @param user_data QueuedStart
+    @returns G_SOURCE_REMOVE
+    */
+    static gboolean startQueued(gpointer user_data)
+    {
+        QueuedStart* queued = static_cast<QueuedStart*>(user_data);
+        if(!queued->stream->start())
+        {
+            std::cout << "Failed to start stream " << queued->stream->name() << '\n';
+            queued->manager->releaseSetup();
+        }
+        delete queued;
+        return G_SOURCE_REMOVE;
+    }
+    /**
+    @brief changes the throttle of a stream on its own worker. A removed stream is destroyed on the same worker after this ran
+    @param user_data QueuedThrottle
+    @returns G_SOURCE_REMOVE
+    */
+    static gboolean applyThrottle(gpointer user_data)
+    {
+        QueuedThrottle* queued = static_cast<QueuedThrottle*>(user_data);
+        queued->stream->throttle(queued->level);
+        delete queued;
+        return G_SOURCE_REMOVE;
+    }
+    /**
+    @brief asks a stream for a throttle level and records it. m_mutex must be held
+    @param stream_id id of the stream
+    @param entry stream and worker
+    @param level new level
+    */
+    void requestThrottle(const std::string& stream_id, const stream_entry& entry, const StreamThrottle level)
+    {
+        if(level == StreamThrottle::NONE)
+            m_throttles.erase(stream_id);
+        else
+            m_throttles[stream_id] = level;
+        invokeOnWorker(entry.second, applyThrottle, new QueuedThrottle{entry.first, level});
+    }
+    /**
+    @param stream_id id of the stream
+    @returns the level asked of the stream. m_mutex must be held
+    */
+    StreamThrottle throttleOf(const std::string& stream_id) const
+    {
+        auto found = m_throttles.find(stream_id);
+        return found != m_throttles.end() ? found->second : StreamThrottle::NONE;
+    }
+    /**
+    @brief memory budget timer callback
+    @param user_data StreamManager
+    @returns G_SOURCE_CONTINUE
+    */
+    static gboolean onBudgetTimer(gpointer user_data)
+    {
+        static_cast<StreamManager*>(user_data)->enforceBudget();
+        return G_SOURCE_CONTINUE;
+    }
+    /**
+    @brief throttles one stream a level further while the streams hold more than the budget, and releases one a level once they
+    hold less than the release ratio. The lowest priority is throttled first and released last, among equal priorities the stream
+    holding the most memory is throttled first
+    */
+    void enforceBudget()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_budget.max_bytes == 0)
+            return;
+
+        struct Candidate
+        {
+            stream_map::iterator entry;
+            gsize                memory;
+            StreamThrottle       level;
+        };
+        std::vector<Candidate> candidates;
+        gsize used = 0;
+        for(auto entry = m_streams.begin(); entry != m_streams.end(); ++entry)
+        {
+            const gsize memory = entry->second.first->resourceUsage().memory();
+            used += memory;
+            candidates.push_back({entry, memory, throttleOf(entry->first)});
+        }
+
+        // true if a should be throttled before b
+        auto before = [](const Candidate& a, const Candidate& b)
+        {
+            const gint a_priority = a.entry->second.first->priority();
+            const gint b_priority = b.entry->second.first->priority();
+            return a_priority != b_priority ? a_priority < b_priority : a.memory > b.memory;
+        };
+        if(used > m_budget.max_bytes)
+        {
+            auto next = candidates.end();
+            for(auto candidate = candidates.begin(); candidate != candidates.end(); ++candidate)
+            {
+                if(candidate->level != StreamThrottle::PAUSE && (next == candidates.end() || before(*candidate, *next)))
+                    next = candidate;
+            }
+            if(next == candidates.end())
+                return;
+
+            const StreamThrottle level = static_cast<StreamThrottle>(static_cast<int>(next->level) + 1);
+            std::cout << "Memory budget exceeded, " << used << " of " << m_budget.max_bytes << " bytes. Throttling stream "
+                      << next->entry->first << " to " << throttleName(level) << '\n';
+            requestThrottle(next->entry->first, next->entry->second, level);
+            m_throttle_steps++;
+        }
+        else if(used < m_budget.max_bytes * m_budget.release_ratio)
+        {
+            auto next = candidates.end();
+            for(auto candidate = candidates.begin(); candidate != candidates.end(); ++candidate)
+            {
+                if(candidate->level != StreamThrottle::NONE && (next == candidates.end() || before(*next, *candidate)))
+                    next = candidate;
+            }
+            if(next == candidates.end())
+                return;
+
+            requestThrottle(next->entry->first, next->entry->second, static_cast<StreamThrottle>(static_cast<int>(next->level) - 1));
+            m_release_steps++;
+        }
+    }
+    /**
+    @brief reconnects a stream that waited for a setup slot, see RtspStream::admitReconnect
+    @param user_data QueuedStart
+    @returns G_SOURCE_REMOVE
+    */
+    static gboolean reconnectQueued(gpointer user_data)
+    {
+        QueuedStart* queued = static_cast<QueuedStart*>(user_data);
+        queued->stream->admitReconnect();
+        delete queued;
+        return G_SOURCE_REMOVE;
+    }
+    /**
+    @returns the worker with the fewest streams. m_mutex must be held
+    */
+    Worker* leastLoadedWorker()
+    {
+        Worker* best = m_workers.front().get();
+        for(auto& worker : m_workers)
+        {
+            if(worker->stream_count < best->stream_count)
+                best = worker.get();
+        }
+        return best;
+    }
+
+    /**
+    @param config stream settings
+    @returns the settings with the manager event queue filled in if the stream has none
+    */
+    StreamConfig withEvents(const StreamConfig& config) const
+    {
+        StreamConfig queued = config;
+        if(!queued.events)
+            queued.events = m_events;
+        return queued;
+    }
+
+public:
+    /**
+    @brief initializes gstreamer, loads every element factory a stream may need and starts the worker threads
+    @param thread_count number of GMainContext threads shared by all streams. 0 uses the number of cores
+    @param max_concurrent_setups rtsp sessions being set up at the same time, first starts and reconnects alike, the rest wait for a slot. 0 sets up every stream at once
+    */
+    explicit StreamManager(size_t thread_count = 0, const size_t max_concurrent_setups = 32)
+        : m_workers(), m_streams(), m_mutex(), m_batched(), m_synced(), m_events(std::make_shared<EventQueue>(4096)),
+          m_budget(), m_budget_source(NULL), m_throttles(), m_throttle_steps(0), m_release_steps(0), m_setup_mutex(), m_setup_queue(), m_setups_in_flight(0), m_max_setups(max_concurrent_setups), m_stopping(false)
+    {
+        gst_init(NULL, NULL);
+        FactoryCache::instance().warm(RtspStream::elementFactories());
+
+        if(thread_count == 0)
+            thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+        for(size_t i = 0; i < thread_count; i++)
+        {
+            std::unique_ptr<Worker> worker(new Worker());
+            worker->context = g_main_context_new();
+            worker->loop = g_main_loop_new(worker->context, FALSE);
+            worker->stream_count = 0;
+            worker->thread = std::thread(runWorker, worker.get());
+            m_workers.push_back(std::move(worker));
+        }
+    }
+    /**
+    @brief stops every stream and joins the worker threads
+    */
+    ~StreamManager()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_setup_mutex);
+            m_stopping = true;
+            m_setup_queue.clear();
+        }
+        if(m_budget_source != NULL)
+        {
+            g_source_destroy(m_budget_source);
+            g_source_unref(m_budget_source);
+        }
+        for(auto& worker : m_workers)
+        {
+            invokeOnWorker(worker.get(), quitWorker, worker->loop);
+            worker->thread.join();
+        }
+        // the loops are stopped, run whatever was still queued and release the remaining streams here
+        for(auto& worker : m_workers)
+        {
+            while(g_main_context_iteration(worker->context, FALSE))
+                ;
+        }
+        for(auto& entry : m_streams)
+            delete entry.second.first;
+        m_streams.clear();
+        m_batched.clear();
+        m_synced.clear();
+
+        for(auto& worker : m_workers)
+        {
+            g_main_loop_unref(worker->loop);
+            g_main_context_unref(worker->context);
+        }
+    }
+
+    StreamManager(StreamManager&&) = delete;
+    StreamManager(const StreamManager&) = delete;
+    /**
+    @brief builds a stream, assigns it to the least loaded worker and starts it playing
+    @param stream_id unique id of the stream
+    @param config stream settings
+    @returns true on success false if the id is taken or the stream failed to start
+    */
+    bool addStream(const std::string& stream_id, const StreamConfig& config)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if(m_streams.find(stream_id) != m_streams.end())
+        {
+            std::cout << "Failed to add stream. A stream with id " << stream_id << " already exists\n";
+            return false;
+        }
+
+        Worker* worker = leastLoadedWorker();
+        RtspStream* stream = new RtspStream(stream_id, withEvents(config), worker->context);
+        if(!requestStart(stream, worker))
+        {
+            std::cout << "Failed to start stream " << stream_id << '\n';
+            delete stream;
+            return false;
+        }
+
+        worker->stream_count++;
+        m_streams[stream_id] = {stream, worker};
+        return true;
+    }
+    /**
+    @brief builds a stream whose frames are delivered through a batcher, see addStream.
+    The frame ring and frame callback of the config are replaced by the batcher input
+    @param stream_id unique id of the stream
+    @param config stream settings
+    @param batcher batcher the frames go to. The manager keeps it alive as long as the stream exists
+    @returns true on success false if the id is taken or the stream failed to start
+    */
+    bool addStream(const std::string& stream_id, const StreamConfig& config, const FrameBatcherPtr& batcher)
+    {
+        StreamConfig batched = config;
+        batched.frame_ring.reset();
+        batched.on_frame = batcher->input(stream_id);
+        if(!addStream(stream_id, batched))
+        {
+            batcher->removeInput(stream_id);
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_batched[stream_id] = batcher;
+        return true;
+    }
+    /**
+    @brief builds a stream whose frames are also kept by a synchronizer, see addStream. The stream stamps frames with their
+    capture time, see StreamConfig::wallclock, and the frame callback of the config still receives every frame
+    @param stream_id unique id of the stream
+    @param config stream settings. A frame ring is replaced by the synchronizer input
+    @param synchronizer synchronizer the frames go to. The manager keeps it alive as long as the stream exists
+    @returns true on success false if the id is taken or the stream failed to start
+    */
+    bool addStream(const std::string& stream_id, const StreamConfig& config, const FrameSynchronizerPtr& synchronizer)
+    {
+        StreamConfig synced = config;
+        synced.wallclock = true;
+        synced.frame_ring.reset();
+        frame_callback input = synchronizer->input(stream_id);
+        frame_callback on_frame = config.on_frame;
+        if(on_frame)
+            synced.on_frame = [input, on_frame](const VideoFramePtr& frame){ input(frame); on_frame(frame); };
+        else
+            synced.on_frame = std::move(input);
+        if(!addStream(stream_id, synced))
+        {
+            synchronizer->removeInput(stream_id);
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_synced[stream_id] = synchronizer;
+        return true;
+    }
+    /**
+    @brief builds and starts many streams at once. Streams are built concurrently on up to one thread per core,
+    so bringing up a large deployment is bound by the slowest stream instead of the sum of all of them.
+    At most max_concurrent_setups sessions are set up at a time, the others start as soon as a slot frees up
+    @param configs stream ids and settings
+    @returns number of streams added. Streams with a taken id or that failed to start are skipped
+    */
+    size_t addStreams(const std::vector<std::pair<std::string, StreamConfig>>& configs)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        struct Pending
+        {
+            const std::string*  stream_id;
+            const StreamConfig* config;
+            Worker*             worker;
+            RtspStream*         stream;
+        };
+        std::vector<Pending> pending;
+        for(const auto& entry : configs)
+        {
+            const bool taken = m_streams.find(entry.first) != m_streams.end() ||
+                               std::any_of(pending.begin(), pending.end(), [&entry](const Pending& other){ return *other.stream_id == entry.first; });
+            if(taken)
+            {
+                std::cout << "Failed to add stream. A stream with id " << entry.first << " already exists\n";
+                continue;
+            }
+
+            // reserve the worker now, so the streams spread evenly no matter which one finishes building first
+            Worker* worker = leastLoadedWorker();
+            worker->stream_count++;
+            pending.push_back({&entry.first, &entry.second, worker, NULL});
+        }
+
+        std::atomic<size_t> next(0);
+        auto builder = [this, &pending, &next]()
+        {
+            for(size_t i = next++; i < pending.size(); i = next++)
+            {
+                Pending& item = pending[i];
+                item.stream = new RtspStream(*item.stream_id, withEvents(*item.config), item.worker->context);
+                if(!requestStart(item.stream, item.worker))
+                {
+                    std::cout << "Failed to start stream " << *item.stream_id << '\n';
+                    delete item.stream;
+                    item.stream = NULL;
+                }
+            }
+        };
+
+        const size_t thread_count = std::min<size_t>(pending.size(), std::max(1u, std::thread::hardware_concurrency()));
+        std::vector<std::thread> threads;
+        for(size_t i = 1; i < thread_count; i++)
+            threads.emplace_back(builder);
+        builder();
+        for(std::thread& thread : threads)
+            thread.join();
+
+        size_t started = 0;
+        for(Pending& item : pending)
+        {
+            if(item.stream == NULL)
+            {
+                item.worker->stream_count--;
+                continue;
+            }
+            m_streams[*item.stream_id] = {item.stream, item.worker};
+            started++;
+        }
+        return started;
+    }
+    /**
+    @brief stops and removes a stream. The stream is torn down asynchronously on its worker thread
+    @param stream_id id of the stream
+    @returns true if the stream existed
+    */
+    bool removeStream(const std::string& stream_id)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto found = m_streams.find(stream_id);
+        if(found == m_streams.end())
+            return false;
+
+        RtspStream* stream = found->second.first;
+        Worker* worker = found->second.second;
+        worker->stream_count--;
+        m_streams.erase(found);
+        {
+            std::lock_guard<std::mutex> setup_lock(m_setup_mutex);
+            m_setup_queue.erase(std::remove_if(m_setup_queue.begin(), m_setup_queue.end(),
+                                               [stream](const QueuedSetup& queued){ return queued.stream == stream; }),
+                                m_setup_queue.end());
+        }
+
+        // the stream may still deliver a few frames until its worker destroys it, the batcher and the synchronizer
+        // drop those and are kept alive by the queued destroy until then
+        QueuedDestroy* destroy = new QueuedDestroy{stream, FrameBatcherPtr(), FrameSynchronizerPtr()};
+        auto batched = m_batched.find(stream_id);
+        if(batched != m_batched.end())
+        {
+            batched->second->removeInput(stream_id);
+            destroy->batcher = batched->second;
+            m_batched.erase(batched);
+        }
+        auto synced = m_synced.find(stream_id);
+        if(synced != m_synced.end())
+        {
+            synced->second->removeInput(stream_id);
+            destroy->synchronizer = synced->second;
+            m_synced.erase(synced);
+        }
+        m_throttles.erase(stream_id);
+        invokeOnWorker(worker, destroyStream, destroy);
+        return true;
+    }
+    /**
+    @returns the number of running streams
+    */
+    size_t streamCount()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_streams.size();
+    }
+    /**
+    @returns the ids of every running stream
+    */
+    std::vector<std::string> streamIds()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        std::vector<std::string> ids;
+        ids.reserve(m_streams.size());
+        for(auto& entry : m_streams)
+            ids.push_back(entry.first);
+        return ids;
+    }
+    /**
+    @brief registers a decode consumer on a stream, see RtspStream::subscribeDecode
+    @param stream_id id of the stream
+    @returns true if the stream exists and its decode branch is attached
+    */
+    bool subscribeDecode(const std::string& stream_id)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto found = m_streams.find(stream_id);
+        return found != m_streams.end() && found->second.first->subscribeDecode();
+    }
+    /**
+    @brief releases a decode consumer on a stream, see RtspStream::unsubscribeDecode
+    @param stream_id id of the stream
+    */
+    void unsubscribeDecode(const std::string& stream_id)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto found = m_streams.find(stream_id);
+        if(found != m_streams.end())
+            found->second.first->unsubscribeDecode();
+    }
+    /**
+    @brief changes the decimation of a running stream, see RtspStream::setDecimation
+    @param stream_id id of the stream
+    @param target_fps drop frames before the decoder down to this rate, 0 decodes every frame
+    @param keyframes_only only decode keyframes
+    @returns true if the stream exists
+    */
+    bool setDecimation(const std::string& stream_id, const double target_fps, const bool keyframes_only)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto found = m_streams.find(stream_id);
+        if(found == m_streams.end())
+            return false;
+
+        found->second.first->setDecimation(target_fps, keyframes_only);
+        return true;
+    }
+    /**
+    @brief returns the decoder a stream was built with
+    @param stream_id id of the stream
+    @returns decoder plugin name, empty if the stream does not exist
+    */
+    std::string streamDecoder(const std::string& stream_id)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto found = m_streams.find(stream_id);
+        return found != m_streams.end() ? found->second.first->decoderName() : std::string();
+    }
+    /**
+    @brief keeps the memory every stream holds inside a budget. Over the budget streams are throttled one level per check:
+    their jitterbuffers and queues are shortened, then only keyframes are decoded, then they are put in standby,
+    see StreamThrottle and StreamConfig::priority. Replaces the previous budget
+    @param budget budget. A max_bytes of 0 lifts every throttle
+    */
+    void setMemoryBudget(const MemoryBudget& budget)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_budget = budget;
+        if(m_budget_source != NULL)
+        {
+            g_source_destroy(m_budget_source);
+            g_source_unref(m_budget_source);
+            m_budget_source = NULL;
+        }
+
+        if(m_budget.max_bytes == 0)
+        {
+            while(!m_throttles.empty())
+            {
+                const std::string stream_id = m_throttles.begin()->first;
+                requestThrottle(stream_id, m_streams.at(stream_id), StreamThrottle::NONE);
+            }
+            return;
+        }
+        m_budget_source = g_timeout_source_new(std::max<guint>(m_budget.interval_ms, 100));
+        g_source_set_callback(m_budget_source, onBudgetTimer, this, NULL);
+        g_source_attach(m_budget_source, m_workers.front()->context);
+    }
+    /**
+    @brief measures what a stream holds, see RtspStream::resourceUsage
+    @param stream_id id of the stream
+    @returns the usage, all zero if the stream does not exist
+    */
+    ResourceUsage streamUsage(const std::string& stream_id)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto found = m_streams.find(stream_id);
+        return found != m_streams.end() ? found->second.first->resourceUsage() : ResourceUsage();
+    }
+    /**
+    @returns memory held by every stream together, see ResourceUsage::memory
+    */
+    gsize memoryUsed()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        gsize used = 0;
+        for(auto& entry : m_streams)
+            used += entry.second.first->resourceUsage().memory();
+        return used;
+    }
+    /**
+    @brief collects the element stats of every instrumented stream
+    @returns Prometheus text exposition of all streams, the pipeline label holds the stream id
+    */
+    std::string metricsPrometheus()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        std::ostringstream stream;
+        PipelineInstrumentation::writePrometheusHeaders(stream);
+        for(auto& entry : m_streams)
+        {
+            const PipelineInstrumentation* instrumentation = entry.second.first->pipeline().instrumentation();
+            if(instrumentation != NULL)
+                instrumentation->writePrometheus(stream, entry.first);
+        }
+
+        stream << "# HELP rtsp_stream_reconnects_total Reconnect attempts made by the stream.\n"
+               << "# TYPE rtsp_stream_reconnects_total counter\n";
+        for(auto& entry : m_streams)
+            stream << "rtsp_stream_reconnects_total{pipeline=\"" << PipelineInstrumentation::escape(entry.first) << "\"} " << entry.second.first->reconnectCount() << '\n';
+
+        stream << "# HELP rtsp_stream_packets_total RTP packets by outcome in the jitterbuffer.\n"
+               << "# TYPE rtsp_stream_packets_total counter\n"
+               << "# HELP rtsp_stream_loss_ratio Packet loss over the last measurement window.\n"
+               << "# TYPE rtsp_stream_loss_ratio gauge\n"
+               << "# HELP rtsp_stream_transport_switches_total Transport fallbacks made by the stream.\n"
+               << "# TYPE rtsp_stream_transport_switches_total counter\n";
+        for(auto& entry : m_streams)
+        {
+            const TransportStats transport = entry.second.first->transportStats();
+            const std::string labels = "pipeline=\"" + PipelineInstrumentation::escape(entry.first) + "\"";
+            stream << "rtsp_stream_packets_total{" << labels << ",outcome=\"pushed\"} " << transport.packets << '\n'
+                   << "rtsp_stream_packets_total{" << labels << ",outcome=\"lost\"} " << transport.lost << '\n'
+                   << "rtsp_stream_packets_total{" << labels << ",outcome=\"late\"} " << transport.late << '\n'
+                   << "rtsp_stream_loss_ratio{" << labels << ",transport=\"" << transportName(transport.transport) << "\"} " << transport.loss_ratio << '\n'
+                   << "rtsp_stream_transport_switches_total{" << labels << "} " << transport.switches << '\n';
+        }
+
+        stream << "# HELP rtsp_stream_glass_to_glass_seconds Time from capture on the camera to the frame reaching the sink.\n"
+               << "# TYPE rtsp_stream_glass_to_glass_seconds histogram\n";
+        for(auto& entry : m_streams)
+        {
+            const LatencyHistogram& latency = entry.second.first->glassToGlass();
+            if(latency.count() != 0)
+                latency.writePrometheus(stream, "rtsp_stream_glass_to_glass_seconds", "pipeline=\"" + PipelineInstrumentation::escape(entry.first) + "\"");
+        }
+
+        std::vector<FrameBatcher*> batchers;
+        for(auto& entry : m_batched)
+        {
+            if(std::find(batchers.begin(), batchers.end(), entry.second.get()) == batchers.end())
+                batchers.push_back(entry.second.get());
+        }
+        if(!batchers.empty())
+            FrameBatcher::writePrometheusHeaders(stream);
+        for(FrameBatcher* batcher : batchers)
+            batcher->writePrometheus(stream, "batcher=\"" + PipelineInstrumentation::escape(batcher->name()) + "\"");
+
+        std::vector<FrameSynchronizer*> synchronizers;
+        for(auto& entry : m_synced)
+        {
+            if(std::find(synchronizers.begin(), synchronizers.end(), entry.second.get()) == synchronizers.end())
+                synchronizers.push_back(entry.second.get());
+        }
+        if(!synchronizers.empty())
+            FrameSynchronizer::writePrometheusHeaders(stream);
+        for(FrameSynchronizer* synchronizer : synchronizers)
+            synchronizer->writePrometheus(stream, "sync=\"" + PipelineInstrumentation::escape(synchronizer->name()) + "\"");
+
+        stream << "# HELP rtsp_events_dropped_total Bus events dropped because the manager event queue was full.\n"
+               << "# TYPE rtsp_events_dropped_total counter\n"
+               << "rtsp_events_dropped_total " << m_events->dropped() << '\n';
+
+        stream << "# HELP rtsp_stream_memory_bytes Memory held by the stream, by where it is held.\n"
+               << "# TYPE rtsp_stream_memory_bytes gauge\n"
+               << "# HELP rtsp_stream_cpu_seconds_total Cpu time of the streaming threads of the stream.\n"
+               << "# TYPE rtsp_stream_cpu_seconds_total counter\n"
+               << "# HELP rtsp_stream_throttle Throttle level the memory budget asked of the stream, 0 none to 3 in standby.\n"
+               << "# TYPE rtsp_stream_throttle gauge\n";
+        gsize used = 0;
+        for(auto& entry : m_streams)
+        {
+            const ResourceUsage usage = entry.second.first->resourceUsage();
+            const std::string labels = "pipeline=\"" + PipelineInstrumentation::escape(entry.first) + "\"";
+            used += usage.memory();
+            stream << "rtsp_stream_memory_bytes{" << labels << ",kind=\"jitterbuffer\"} " << usage.jitterbuffer_bytes << '\n'
+                   << "rtsp_stream_memory_bytes{" << labels << ",kind=\"queue\"} " << usage.queue_bytes << '\n'
+                   << "rtsp_stream_memory_bytes{" << labels << ",kind=\"pool\"} " << usage.pool_bytes << '\n'
+                   << "rtsp_stream_memory_bytes{" << labels << ",kind=\"ring\"} " << usage.ring_bytes << '\n'
+                   << "rtsp_stream_memory_bytes{" << labels << ",kind=\"pre_event\"} " << usage.pre_event_bytes << '\n'
+                   << "rtsp_stream_cpu_seconds_total{" << labels << "} " << usage.cpu_time / 1e9 << '\n'
+                   << "rtsp_stream_throttle{" << labels << "} " << static_cast<int>(throttleOf(entry.first)) << '\n';
+        }
+        stream << "# HELP rtsp_memory_used_bytes Memory held by every stream together.\n"
+               << "# TYPE rtsp_memory_used_bytes gauge\n"
+               << "rtsp_memory_used_bytes " << used << '\n'
+               << "# HELP rtsp_memory_budget_bytes Memory budget of the streams, 0 when there is none.\n"
+               << "# TYPE rtsp_memory_budget_bytes gauge\n"
+               << "rtsp_memory_budget_bytes " << m_budget.max_bytes << '\n'
+               << "# HELP rtsp_budget_steps_total Throttle levels applied and lifted by the memory budget.\n"
+               << "# TYPE rtsp_budget_steps_total counter\n"
+               << "rtsp_budget_steps_total{action=\"throttle\"} " << m_throttle_steps << '\n'
+               << "rtsp_budget_steps_total{action=\"release\"} " << m_release_steps << '\n';
+
+        stream << "# HELP rtsp_stream_time_to_playing_seconds Time from the last start or resume until the pipeline was PLAYING.\n"
+               << "# TYPE rtsp_stream_time_to_playing_seconds gauge\n"
+               << "# HELP rtsp_stream_time_to_first_frame_seconds Time from the last start or resume until the first frame reached the sink.\n"
+               << "# TYPE rtsp_stream_time_to_first_frame_seconds gauge\n";
+        for(auto& entry : m_streams)
+        {
+            const std::string labels = "pipeline=\"" + PipelineInstrumentation::escape(entry.first) + "\"";
+            const gint64 playing = entry.second.first->timeToPlaying();
+            const gint64 first_frame = entry.second.first->timeToFirstFrame();
+            if(playing >= 0)
+                stream << "rtsp_stream_time_to_playing_seconds{" << labels << "} " << playing / 1e6 << '\n';
+            if(first_frame >= 0)
+                stream << "rtsp_stream_time_to_first_frame_seconds{" << labels << "} " << first_frame / 1e6 << '\n';
+        }
+        return stream.str();
+    }
+    /**
+    @brief estimates a glass to glass latency percentile of a stream, see RtspStream::glassToGlass
+    @param stream_id id of the stream
+    @param fraction percentile as a fraction, EG 0.99
+    @returns the percentile in microseconds, 0 if the stream does not exist or measured nothing yet
+    */
+    guint64 glassToGlassPercentile(const std::string& stream_id, const double fraction)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto found = m_streams.find(stream_id);
+        return found != m_streams.end() ? found->second.first->glassToGlass().percentileUs(fraction) : 0;
+    }
+    /**
+    @brief queue receiving the bus events of every stream that wasn't given its own StreamConfig::events.
+    Drain it from any thread with EventQueue::tryPop, events that don't fit are dropped and counted
+    @returns See above
+    */
+    const EventQueuePtr& events() const
+    {
+        return m_events;
+    }
+    /**
+    @returns the number of worker threads
+    */
+    size_t workerCount() const
+    {
+        return m_workers.size();
+    }
+};
+
+
+#endif // STREAM_MANAGER_H
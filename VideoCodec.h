@@ -0,0 +1,99 @@
+#ifndef VIDEO_CODEC_H
+#define VIDEO_CODEC_H
+
+#include <gst/gst.h>
+
+#include <string>
+#include <vector>
+
+
+
+
+/**
+@brief video codec of a stream
+*/
+enum class VideoCodec
+{
+    AUTO,       // read from the encoding-name of the first video pad rtspsrc adds
+    H264,
+    H265,
+    MJPEG,
+    AV1
+};
+
+
+/**
+@brief elements handling one codec between the depayloader and the decoder
+*/
+struct CodecElements
+{
+    const char*              name;              // codec name used in logs
+    const char*              depay;             // rtp depayloader
+    const char*              parse;             // parser producing one complete frame per buffer
+    std::string              frame_caps;        // caps of the parser output the branches link with
+    std::vector<std::string> decoders;          // in order of preference. Hardware decoders first, software last
+    const char*              cuda_decoder;      // decoder that can output CUDA memory
+    const char*              segment_muxer;     // muxer splitmuxsink records segments with
+    bool                     nal_stream;        // byte-stream with start codes the decimator can inspect
+};
+
+
+/**
+@param codec codec, AUTO is not valid
+@returns the elements of the codec
+*/
+inline const CodecElements& codecElements(const VideoCodec codec)
+{
+    static const CodecElements h264 = {"h264", "rtph264depay", "h264parse",
+                                       "video/x-h264, stream-format=(string)byte-stream, alignment=(string)au",
+                                       {"vaapih264dec", "nvh264dec", "v4l2h264dec", "avdec_h264"}, "nvh264dec", "mp4mux", true};
+    static const CodecElements h265 = {"h265", "rtph265depay", "h265parse",
+                                       "video/x-h265, stream-format=(string)byte-stream, alignment=(string)au",
+                                       {"vaapih265dec", "nvh265dec", "v4l2h265dec", "avdec_h265"}, "nvh265dec", "mp4mux", true};
+    static const CodecElements mjpeg = {"mjpeg", "rtpjpegdepay", "jpegparse",
+                                        "image/jpeg",
+                                        {"vaapijpegdec", "nvjpegdec", "v4l2jpegdec", "jpegdec"}, "nvjpegdec", "matroskamux", false};
+    // rtpav1depay ships with gst-plugins-rs and av1parse from gstreamer 1.20, dav1d is the fastest software decoder
+    static const CodecElements av1 = {"av1", "rtpav1depay", "av1parse",
+                                      "video/x-av1, stream-format=(string)obu-stream, alignment=(string)tu",
+                                      {"vaapiav1dec", "nvav1dec", "v4l2av1dec", "dav1ddec", "av1dec"}, "nvav1dec", "mp4mux", false};
+    switch(codec)
+    {
+        case VideoCodec::H265:
+            return h265;
+        case VideoCodec::MJPEG:
+            return mjpeg;
+        case VideoCodec::AV1:
+            return av1;
+        default:
+            return h264;
+    }
+}
+/**
+@param encoding_name encoding-name of an application/x-rtp pad, EG H264
+@returns the codec, AUTO if it isn't supported
+*/
+inline VideoCodec codecFromEncodingName(const std::string& encoding_name)
+{
+    const gchar* name = encoding_name.c_str();
+    if(g_ascii_strcasecmp(name, "H264") == 0)
+        return VideoCodec::H264;
+    if(g_ascii_strcasecmp(name, "H265") == 0)
+        return VideoCodec::H265;
+    if(g_ascii_strcasecmp(name, "JPEG") == 0)
+        return VideoCodec::MJPEG;
+    if(g_ascii_strcasecmp(name, "AV1") == 0)
+        return VideoCodec::AV1;
+    return VideoCodec::AUTO;
+}
+/**
+@returns every codec a stream can carry
+*/
+inline const std::vector<VideoCodec>& videoCodecs()
+{
+    static const std::vector<VideoCodec> codecs = {VideoCodec::H264, VideoCodec::H265, VideoCodec::MJPEG, VideoCodec::AV1};
+    return codecs;
+}
+
+
+#endif // VIDEO_CODEC_H
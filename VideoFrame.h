@@ -0,0 +1,208 @@
+#ifndef VIDEO_FRAME_H
+#define VIDEO_FRAME_H
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include <functional>
+#include <memory>
+
+
+// caps feature and map flag of GstCudaMemory, from gst/cuda/gstcudamemory.h. Defined here so host only builds don't need libgstcuda
+#ifndef GST_CAPS_FEATURE_MEMORY_CUDA_MEMORY
+#define GST_CAPS_FEATURE_MEMORY_CUDA_MEMORY "memory:CUDAMemory"
+#endif
+#ifndef GST_MAP_CUDA
+#define GST_MAP_CUDA ((GstMapFlags) (GST_MAP_FLAG_LAST << 1))
+#endif
+
+
+/**
+@brief read only view of a decoded frame pulled from an appsink.
+The sample reference is held for the lifetime of the view and the buffer stays mapped,
+so the plane pointers are valid until the last VideoFramePtr copy is released. No pixel data is copied.
+Frames negotiated with memory:CUDAMemory are mapped on the device, their plane pointers are CUdeviceptr values
+*/
+class VideoFrame
+{
+private:
+    GstSample*    m_sample;
+    GstVideoFrame m_frame;
+    bool          m_mapped;
+    bool          m_device;
+    GstClockTime  m_base_time;  // base time of the pipeline the frame was pulled from
+
+    /**
+    @returns caps the jitterbuffer tags sender NTP reference timestamps with
+    */
+    static GstCaps* ntpTimestampCaps()
+    {
+        static GstCaps* caps = gst_caps_new_empty_simple("timestamp/x-ntp");
+        return caps;
+    }
+
+public:
+    /**
+    @brief maps the buffer held by the sample
+    @param sample sample to map. The view takes ownership of the reference
+    @param base_time base time of the element the sample was pulled from, GST_CLOCK_TIME_NONE if unknown
+    */
+    explicit VideoFrame(GstSample* sample, const GstClockTime base_time = GST_CLOCK_TIME_NONE)
+        : m_sample(sample), m_frame(), m_mapped(false), m_device(false), m_base_time(base_time)
+    {
+        if(G_UNLIKELY(m_sample == NULL))
+            return;
+
+        GstBuffer* buffer = gst_sample_get_buffer(m_sample);
+        GstCaps* caps = gst_sample_get_caps(m_sample);
+        GstVideoInfo info;
+
+        if(G_UNLIKELY(buffer == NULL || caps == NULL || !gst_video_info_from_caps(&info, caps)))
+            return;
+
+        GstCapsFeatures* features = gst_caps_get_features(caps, 0);
+        m_device = features != NULL && gst_caps_features_contains(features, GST_CAPS_FEATURE_MEMORY_CUDA_MEMORY);
+        // mapping cuda memory without GST_MAP_CUDA would download the frame to the host
+        m_mapped = gst_video_frame_map(&m_frame, &info, buffer, m_device ? static_cast<GstMapFlags>(GST_MAP_READ | GST_MAP_CUDA) : GST_MAP_READ);
+    }
+    /**
+    @brief unmaps the buffer and releases the sample reference
+    */
+    ~VideoFrame()
+    {
+        if(m_mapped)
+            gst_video_frame_unmap(&m_frame);
+        if(m_sample != NULL)
+            gst_sample_unref(m_sample);
+    }
+
+    VideoFrame(VideoFrame&&) = delete;
+    VideoFrame(const VideoFrame&) = delete;
+    /**
+    @returns true if the buffer was mapped. Every other accessor is invalid if this returns false
+    */
+    bool isMapped() const
+    {
+        return m_mapped;
+    }
+    /**
+    @returns true if the planes live in CUDA device memory. planeData is then a device pointer and must not be dereferenced on the host
+    */
+    bool isDevice() const
+    {
+        return m_device;
+    }
+    /**
+    @brief returns the device address of the plane, for handing the frame to CUDA or TensorRT without a copy
+    @param plane plane index. Must be less than planes()
+    @returns the CUdeviceptr of the plane, 0 if the frame is in host memory
+    */
+    guintptr devicePointer(const guint plane) const
+    {
+        return m_device ? reinterpret_cast<guintptr>(GST_VIDEO_FRAME_PLANE_DATA(&m_frame, plane)) : 0;
+    }
+    /**
+    @returns frame width in pixels
+    */
+    guint width() const
+    {
+        return GST_VIDEO_FRAME_WIDTH(&m_frame);
+    }
+    /**
+    @returns frame height in pixels
+    */
+    guint height() const
+    {
+        return GST_VIDEO_FRAME_HEIGHT(&m_frame);
+    }
+    /**
+    @returns pixel format of the frame
+    */
+    GstVideoFormat format() const
+    {
+        return GST_VIDEO_FRAME_FORMAT(&m_frame);
+    }
+    /**
+    @returns number of planes in the frame
+    */
+    guint planes() const
+    {
+        return GST_VIDEO_FRAME_N_PLANES(&m_frame);
+    }
+    /**
+    @brief returns a pointer to the first byte of the plane. A device pointer if isDevice
+    @param plane plane index. Must be less than planes()
+    @returns See above
+    */
+    const guint8* planeData(const guint plane) const
+    {
+        return static_cast<const guint8*>(GST_VIDEO_FRAME_PLANE_DATA(&m_frame, plane));
+    }
+    /**
+    @brief returns the plane stride in bytes
+    @param plane plane index. Must be less than planes()
+    @returns See above
+    */
+    gint planeStride(const guint plane) const
+    {
+        return GST_VIDEO_FRAME_PLANE_STRIDE(&m_frame, plane);
+    }
+    /**
+    @brief returns the number of rows in the plane
+    @param plane plane index. Must be less than planes()
+    @returns See above
+    */
+    guint planeHeight(const guint plane) const
+    {
+        // plane and component index match for the planar and packed formats delivered here
+        return GST_VIDEO_FRAME_COMP_HEIGHT(&m_frame, plane);
+    }
+    /**
+    @returns presentation timestamp of the buffer, GST_CLOCK_TIME_NONE if unknown
+    */
+    GstClockTime pts() const
+    {
+        return GST_BUFFER_PTS(m_frame.buffer);
+    }
+    /**
+    @brief returns the pipeline clock time the frame was captured at. With rtspsrc ntp-sync the sender reports map the rtp timestamps
+    to the camera clock, so on a realtime pipeline clock this is nanoseconds since the unix epoch, see StreamConfig::wallclock
+    @returns See above, GST_CLOCK_TIME_NONE if unknown
+    */
+    GstClockTime captureTime() const
+    {
+        // from gstreamer 1.22 on rtspsrc can attach the sender NTP time itself, which is exact even before the clock mapping settles
+        const GstClockTime ntp_unix_offset = G_GUINT64_CONSTANT(2208988800) * GST_SECOND;
+        GstReferenceTimestampMeta* meta = gst_buffer_get_reference_timestamp_meta(m_frame.buffer, ntpTimestampCaps());
+        if(meta != NULL && meta->timestamp >= ntp_unix_offset)
+            return meta->timestamp - ntp_unix_offset;
+
+        const GstSegment* segment = gst_sample_get_segment(m_sample);
+        const GstClockTime pts = GST_BUFFER_PTS(m_frame.buffer);
+        if(!GST_CLOCK_TIME_IS_VALID(m_base_time) || segment == NULL || !GST_CLOCK_TIME_IS_VALID(pts))
+            return GST_CLOCK_TIME_NONE;
+        const GstClockTime running_time = gst_segment_to_running_time(segment, GST_FORMAT_TIME, pts);
+        return GST_CLOCK_TIME_IS_VALID(running_time) ? m_base_time + running_time : GST_CLOCK_TIME_NONE;
+    }
+    /**
+    @returns the underlying sample. The view keeps ownership
+    */
+    GstSample* sample() const
+    {
+        return m_sample;
+    }
+    /**
+    @returns the underlying buffer. The view keeps ownership
+    */
+    GstBuffer* buffer() const
+    {
+        return m_frame.buffer;
+    }
+};
+
+
+typedef std::shared_ptr<VideoFrame> VideoFramePtr;
+typedef std::function<void(const VideoFramePtr&)> frame_callback;
+
+
+#endif // VIDEO_FRAME_H
@@ -0,0 +1,61 @@
+#ifndef VIDEO_FRAME_MAT_H
+#define VIDEO_FRAME_MAT_H
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <opencv2/core.hpp>
+
+#include "VideoFrame.h"
+
+
+
+
+/**
+@brief wraps one plane of a frame in a cv::Mat header. Nothing is copied or allocated, the Mat points straight
+at the mapped buffer, so it is only valid while the VideoFramePtr is alive and must be treated as read only
+@param frame mapped frame
+@param plane plane index. Must be less than planes()
+@returns the plane, an empty Mat if the format has no fixed 8 bit layout or the frame is in device memory
+*/
+inline cv::Mat planeToMat(const VideoFrame& frame, const guint plane)
+{
+    if(!frame.isMapped() || frame.isDevice() || plane >= frame.planes())
+        return cv::Mat();
+
+    // chroma planes of the subsampled formats are half size in both directions
+    const bool chroma = plane > 0;
+    const int rows = chroma ? (frame.height() + 1) / 2 : frame.height();
+    const int cols = chroma ? (frame.width() + 1) / 2 : frame.width();
+    void* data = const_cast<guint8*>(frame.planeData(plane));
+    const size_t step = frame.planeStride(plane);
+
+    switch(frame.format())
+    {
+        case GST_VIDEO_FORMAT_GRAY8:
+            return cv::Mat(rows, cols, CV_8UC1, data, step);
+        case GST_VIDEO_FORMAT_I420:
+            return cv::Mat(rows, cols, CV_8UC1, data, step);
+        case GST_VIDEO_FORMAT_NV12:
+            return cv::Mat(rows, cols, chroma ? CV_8UC2 : CV_8UC1, data, step);
+        case GST_VIDEO_FORMAT_BGR:
+        case GST_VIDEO_FORMAT_RGB:
+            return cv::Mat(frame.height(), frame.width(), CV_8UC3, data, step);
+        case GST_VIDEO_FORMAT_BGRx:
+        case GST_VIDEO_FORMAT_BGRA:
+            return cv::Mat(frame.height(), frame.width(), CV_8UC4, data, step);
+        default:
+            return cv::Mat();
+    }
+}
+/**
+@brief wraps a packed frame, or the luma plane of a planar frame, in a cv::Mat header. See planeToMat
+@param frame mapped frame
+@returns See above
+*/
+inline cv::Mat frameToMat(const VideoFrame& frame)
+{
+    return planeToMat(frame, 0);
+}
+
+
+#endif // VIDEO_FRAME_MAT_H
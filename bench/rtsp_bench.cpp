@@ -0,0 +1,355 @@
+#include <gst/gst.h>
+#include <gst/rtsp-server/rtsp-server.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "StreamManager.h"
+
+
+
+
+/**
+@brief benchmark settings, see usage()
+*/
+struct BenchConfig
+{
+    guint streams;      // client streams
+    guint mounts;       // server mounts the clients are spread over, each one runs a single shared encoder
+    guint width;
+    guint height;
+    guint fps;
+    guint warmup_s;     // seconds before the measurement window starts
+    guint duration_s;   // length of the measurement window
+    guint threads;      // StreamManager worker threads, 0 uses one per core
+    bool  encoded;      // stop after h264parse and count access units instead of decoding
+    std::string profile;    // low-latency or smooth
+
+    BenchConfig()
+        : streams(4), mounts(1), width(1280), height(720), fps(30), warmup_s(3), duration_s(10), threads(0), encoded(false), profile("low-latency")
+    {}
+};
+
+
+/**
+@brief counters of one client stream, updated from the streaming threads
+*/
+struct BenchStream
+{
+    std::string          id;
+    std::atomic<guint64> frames;
+    std::atomic<gint64>  first_frame_us;    // g_get_monotonic_time of the first frame, 0 until then
+
+    explicit BenchStream(const std::string& stream_id)
+        : id(stream_id), frames(0), first_frame_us(0)
+    {}
+
+    void onFrame()
+    {
+        if(G_UNLIKELY(frames.fetch_add(1, std::memory_order_relaxed) == 0))
+            first_frame_us.store(g_get_monotonic_time(), std::memory_order_relaxed);
+    }
+};
+
+
+
+
+/**
+@brief prints the command line help
+@param program program name
+*/
+void usage(const char* program)
+{
+    std::cerr << "usage: " << program << " [options]\n"
+              << "  --streams N     client streams (4)\n"
+              << "  --mounts N      server mounts, one encoder each (1)\n"
+              << "  --width N       source width (1280)\n"
+              << "  --height N      source height (720)\n"
+              << "  --fps N         source framerate (30)\n"
+              << "  --warmup S      seconds before measuring (3)\n"
+              << "  --duration S    seconds measured (10)\n"
+              << "  --threads N     StreamManager worker threads, 0 per core (0)\n"
+              << "  --profile P     low-latency or smooth (low-latency)\n"
+              << "  --encoded       count access units instead of decoding\n"
+              << "Results are written to stdout as one JSON object. cpu includes the in process encoders, one per mount\n";
+}
+/**
+@brief parses the command line
+@param argc argument count
+@param argv arguments
+@param config receives the settings
+@returns false on an unknown or incomplete option
+*/
+bool parseArguments(int argc, char* argv[], BenchConfig& config)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string option = argv[i];
+        if(option == "--encoded")
+        {
+            config.encoded = true;
+            continue;
+        }
+        if(i + 1 >= argc)
+            return false;
+
+        const char* value = argv[++i];
+        if(option == "--streams")
+            config.streams = std::max(1, std::atoi(value));
+        else if(option == "--mounts")
+            config.mounts = std::max(1, std::atoi(value));
+        else if(option == "--width")
+            config.width = std::max(16, std::atoi(value));
+        else if(option == "--height")
+            config.height = std::max(16, std::atoi(value));
+        else if(option == "--fps")
+            config.fps = std::max(1, std::atoi(value));
+        else if(option == "--warmup")
+            config.warmup_s = std::max(0, std::atoi(value));
+        else if(option == "--duration")
+            config.duration_s = std::max(1, std::atoi(value));
+        else if(option == "--threads")
+            config.threads = std::max(0, std::atoi(value));
+        else if(option == "--profile")
+            config.profile = value;
+        else
+            return false;
+    }
+    return config.profile == "low-latency" || config.profile == "smooth";
+}
+/**
+@returns user plus system cpu time of the process in microseconds
+*/
+gint64 cpuTimeUs()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (static_cast<gint64>(usage.ru_utime.tv_sec) + usage.ru_stime.tv_sec) * G_USEC_PER_SEC + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+/**
+@returns resident set size of the process in bytes, 0 if unknown
+*/
+guint64 residentBytes()
+{
+    FILE* statm = std::fopen("/proc/self/statm", "r");
+    if(statm == NULL)
+        return 0;
+
+    unsigned long size = 0, resident = 0;
+    const int read = std::fscanf(statm, "%lu %lu", &size, &resident);
+    std::fclose(statm);
+    return read == 2 ? static_cast<guint64>(resident) * sysconf(_SC_PAGESIZE) : 0;
+}
+/**
+@brief nearest rank percentile of a sorted vector
+@param sorted sorted values
+@param fraction percentile as a fraction
+@returns See above, 0 if empty
+*/
+double percentile(const std::vector<double>& sorted, const double fraction)
+{
+    if(sorted.empty())
+        return 0.0;
+    const size_t rank = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+
+
+
+/**
+@brief in process rtsp server with synthetic sources, running on its own thread
+*/
+class BenchServer
+{
+private:
+    GMainContext*  m_context;
+    GMainLoop*     m_loop;
+    GstRTSPServer* m_server;
+    std::thread    m_thread;
+    gint           m_port;
+
+public:
+    explicit BenchServer(const BenchConfig& config)
+        : m_context(g_main_context_new()), m_loop(g_main_loop_new(m_context, FALSE)), m_server(gst_rtsp_server_new()), m_thread(), m_port(0)
+    {
+        gst_rtsp_server_set_address(m_server, "127.0.0.1");
+        gst_rtsp_server_set_service(m_server, "0");         // any free port, read back once attached
+
+        // a timestamped live source encoded the way cameras do, one IDR per second and no B frames
+        const std::string launch = "( videotestsrc is-live=true pattern=ball ! video/x-raw,width=" + std::to_string(config.width) +
+                                   ",height=" + std::to_string(config.height) + ",framerate=" + std::to_string(config.fps) + "/1"
+                                   " ! x264enc tune=zerolatency speed-preset=ultrafast bframes=0 key-int-max=" + std::to_string(config.fps) +
+                                   " ! rtph264pay name=pay0 pt=96 config-interval=-1 )";
+
+        GstRTSPMountPoints* mounts = gst_rtsp_server_get_mount_points(m_server);
+        for(guint i = 0; i < config.mounts; i++)
+        {
+            GstRTSPMediaFactory* factory = gst_rtsp_media_factory_new();
+            gst_rtsp_media_factory_set_launch(factory, launch.c_str());
+            gst_rtsp_media_factory_set_shared(factory, TRUE);   // every client of a mount shares its encoder
+            gst_rtsp_mount_points_add_factory(mounts, ("/bench" + std::to_string(i)).c_str(), factory);
+        }
+        g_object_unref(mounts);
+
+        if(gst_rtsp_server_attach(m_server, m_context) == 0)
+            std::cerr << "Failed to attach the rtsp server\n";
+        m_port = gst_rtsp_server_get_bound_port(m_server);
+
+        GMainLoop* loop = m_loop;
+        GMainContext* context = m_context;
+        m_thread = std::thread([loop, context]()
+        {
+            g_main_context_push_thread_default(context);
+            g_main_loop_run(loop);
+            g_main_context_pop_thread_default(context);
+        });
+    }
+    ~BenchServer()
+    {
+        g_main_loop_quit(m_loop);
+        m_thread.join();
+        g_object_unref(m_server);
+        g_main_loop_unref(m_loop);
+        g_main_context_unref(m_context);
+    }
+
+    BenchServer(BenchServer&&) = delete;
+    BenchServer(const BenchServer&) = delete;
+    /**
+    @param mount mount index
+    @returns rtsp location of the mount
+    */
+    std::string location(const guint mount) const
+    {
+        return "rtsp://127.0.0.1:" + std::to_string(m_port) + "/bench" + std::to_string(mount);
+    }
+    /**
+    @returns true if the server is listening
+    */
+    bool isListening() const
+    {
+        return m_port > 0;
+    }
+};
+
+
+
+
+int main(int argc, char* argv[])
+{
+    BenchConfig bench;
+    if(!parseArguments(argc, argv, bench))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    gst_init(&argc, &argv);
+    BenchServer server(bench);
+    if(!server.isListening())
+        return 1;
+
+    // declared before the manager, the streams it runs count frames into these until it is destroyed
+    std::vector<std::unique_ptr<BenchStream>> streams;
+    StreamManager manager(bench.threads);
+    const guint64 rss_before = residentBytes();
+
+    std::vector<std::pair<std::string, StreamConfig>> configs;
+    for(guint i = 0; i < bench.streams; i++)
+    {
+        streams.emplace_back(new BenchStream("bench" + std::to_string(i)));
+        BenchStream* counters = streams.back().get();
+
+        StreamConfig config;
+        config.location = server.location(i % bench.mounts);
+        config.latency = latencySettings(bench.profile == "smooth" ? LatencyProfile::SMOOTH : LatencyProfile::LOW_LATENCY);
+        config.measure_latency = true;
+        config.transport = RtspTransport::TCP;  // loopback udp drops under load, which would measure the kernel instead of the client
+        if(bench.encoded)
+        {
+            config.decode = false;
+            config.on_access_unit = [counters](const EncodedFramePtr&){ counters->onFrame(); };
+        }
+        else
+            config.on_frame = [counters](const VideoFramePtr&){ counters->onFrame(); };
+        configs.push_back({counters->id, config});
+    }
+
+    const gint64 start_us = g_get_monotonic_time();
+    const size_t added = manager.addStreams(configs);
+
+    g_usleep(static_cast<gulong>(bench.warmup_s) * G_USEC_PER_SEC);
+    std::vector<guint64> frames_before;
+    for(auto& stream : streams)
+        frames_before.push_back(stream->frames.load());
+    const gint64 window_start_us = g_get_monotonic_time();
+    const gint64 cpu_before = cpuTimeUs();
+
+    g_usleep(static_cast<gulong>(bench.duration_s) * G_USEC_PER_SEC);
+    const gint64 window_us = g_get_monotonic_time() - window_start_us;
+    const gint64 cpu_us = cpuTimeUs() - cpu_before;
+    const guint64 rss_after = residentBytes();
+
+    std::vector<double> fps, startup_ms, latency_p50_ms, latency_p99_ms;
+    guint started = 0;
+    for(size_t i = 0; i < streams.size(); i++)
+    {
+        BenchStream& stream = *streams[i];
+        fps.push_back((stream.frames.load() - frames_before[i]) * 1e6 / window_us);
+        const gint64 first = stream.first_frame_us.load();
+        if(first != 0)
+        {
+            startup_ms.push_back((first - start_us) / 1e3);
+            started++;
+        }
+        const guint64 p50 = manager.glassToGlassPercentile(stream.id, 0.50);
+        const guint64 p99 = manager.glassToGlassPercentile(stream.id, 0.99);
+        if(p50 != 0)
+        {
+            latency_p50_ms.push_back(p50 / 1e3);
+            latency_p99_ms.push_back(p99 / 1e3);
+        }
+    }
+    std::sort(fps.begin(), fps.end());
+    std::sort(startup_ms.begin(), startup_ms.end());
+    std::sort(latency_p50_ms.begin(), latency_p50_ms.end());
+    std::sort(latency_p99_ms.begin(), latency_p99_ms.end());
+
+    double total_fps = 0.0;
+    for(const double value : fps)
+        total_fps += value;
+    const double cpu_percent = 100.0 * cpu_us / window_us;
+    const double rss_per_stream = added != 0 && rss_after > rss_before ? static_cast<double>(rss_after - rss_before) / added : 0.0;
+
+    gchar* version = gst_version_string();
+    // one json object on stdout so results can be collected and compared between runs
+    std::printf("{\"streams\":%u,\"added\":%zu,\"started\":%u,\"mounts\":%u,\"width\":%u,\"height\":%u,\"source_fps\":%u,"
+                "\"profile\":\"%s\",\"mode\":\"%s\",\"gstreamer\":\"%s\",\"window_s\":%.3f,"
+                "\"fps\":{\"total\":%.2f,\"min\":%.2f,\"p50\":%.2f,\"max\":%.2f},"
+                "\"startup_ms\":{\"p50\":%.1f,\"p99\":%.1f,\"max\":%.1f},"
+                "\"glass_to_glass_ms\":{\"p50\":%.2f,\"p99\":%.2f,\"worst_p99\":%.2f},"
+                "\"cpu_percent\":%.1f,\"cpu_percent_per_stream\":%.2f,"
+                "\"rss_bytes\":%llu,\"rss_bytes_per_stream\":%.0f}\n",
+                bench.streams, added, started, bench.mounts, bench.width, bench.height, bench.fps,
+                bench.profile.c_str(), bench.encoded ? "encoded" : "decoded", version, window_us / 1e6,
+                total_fps, fps.empty() ? 0.0 : fps.front(), percentile(fps, 0.50), fps.empty() ? 0.0 : fps.back(),
+                percentile(startup_ms, 0.50), percentile(startup_ms, 0.99), startup_ms.empty() ? 0.0 : startup_ms.back(),
+                percentile(latency_p50_ms, 0.50), percentile(latency_p99_ms, 0.50), latency_p99_ms.empty() ? 0.0 : latency_p99_ms.back(),
+                cpu_percent, added != 0 ? cpu_percent / added : 0.0,
+                static_cast<unsigned long long>(rss_after), rss_per_stream);
+    std::fflush(stdout);
+    g_free(version);
+    return started == bench.streams ? 0 : 1;
+}